@@ -0,0 +1,48 @@
+#ifndef ALIGNED_ALLOCATOR_H_INCLUDED
+#define ALIGNED_ALLOCATOR_H_INCLUDED
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+
+// allocator for std::vector with buffers aligned to the cache line
+template <class T, size_t Alignment = 64>
+class AlignedAllocator {
+public:
+    using value_type = T;
+
+    template <class U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() noexcept {}
+    template <class U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+    T* allocate(const size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T),
+            std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* p, const size_t) noexcept {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <class U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept {
+        return true;
+    }
+
+    template <class U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept {
+        return false;
+    }
+};
+
+
+template <class T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+#endif // ALIGNED_ALLOCATOR_H_INCLUDED
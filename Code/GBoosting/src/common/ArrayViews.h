@@ -0,0 +1,93 @@
+#ifndef ARRAY_VIEWS_H_INCLUDED
+#define ARRAY_VIEWS_H_INCLUDED
+
+#include <cstddef>
+#include <vector>
+
+
+// Non-owning views of the caller's arrays (numpy arrays, std::vector, etc.).
+// Strides are given in elements, so sliced and Fortran-ordered
+// arrays are used without copies
+
+template <class T>
+class VectorView {
+public:
+    VectorView(): ptr(nullptr), len(0), step(1) {}
+    VectorView(T* data, const size_t size, const ptrdiff_t stride = 1):
+        ptr(data), len(size), step(stride) {}
+    template <class U, class Alloc>
+    VectorView(std::vector<U, Alloc>& vec): ptr(vec.data()),
+        len(vec.size()), step(1) {}
+    template <class U, class Alloc>
+    VectorView(const std::vector<U, Alloc>& vec): ptr(vec.data()),
+        len(vec.size()), step(1) {}
+
+    T& operator()(const size_t i) const {
+        return ptr[ptrdiff_t(i) * step];
+    }
+    T& operator[](const size_t i) const {
+        return ptr[ptrdiff_t(i) * step];
+    }
+    size_t size() const {
+        return len;
+    }
+    size_t shape(const size_t) const {
+        return len;
+    }
+    T* data() const {
+        return ptr;
+    }
+    ptrdiff_t stride() const {
+        return step;
+    }
+private:
+    T* ptr;
+    size_t len;
+    ptrdiff_t step;
+};
+
+
+template <class T>
+class MatrixView {
+public:
+    MatrixView(): ptr(nullptr), rows(0), cols(0), rowStep(0), colStep(1) {}
+    // C-ordered (row-major) matrix by default
+    MatrixView(T* data, const size_t rowCnt, const size_t colCnt):
+        ptr(data), rows(rowCnt), cols(colCnt), rowStep(ptrdiff_t(colCnt)),
+        colStep(1) {}
+    MatrixView(T* data, const size_t rowCnt, const size_t colCnt,
+        const ptrdiff_t rowStride, const ptrdiff_t colStride):
+        ptr(data), rows(rowCnt), cols(colCnt), rowStep(rowStride),
+        colStep(colStride) {}
+
+    T& operator()(const size_t i, const size_t j) const {
+        return ptr[ptrdiff_t(i) * rowStep + ptrdiff_t(j) * colStep];
+    }
+    // 0 - row count, 1 - column count
+    size_t shape(const size_t dim) const {
+        return (dim == 0)? rows : cols;
+    }
+    T* data() const {
+        return ptr;
+    }
+    ptrdiff_t rowStride() const {
+        return rowStep;
+    }
+    ptrdiff_t colStride() const {
+        return colStep;
+    }
+    VectorView<T> row(const size_t i) const {
+        return VectorView<T>(ptr + ptrdiff_t(i) * rowStep, cols, colStep);
+    }
+    VectorView<T> col(const size_t j) const {
+        return VectorView<T>(ptr + ptrdiff_t(j) * colStep, rows, rowStep);
+    }
+private:
+    T* ptr;
+    size_t rows;
+    size_t cols;
+    ptrdiff_t rowStep;
+    ptrdiff_t colStep;
+};
+
+#endif // ARRAY_VIEWS_H_INCLUDED
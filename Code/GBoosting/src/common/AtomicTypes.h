@@ -1,7 +1,10 @@
 #ifndef ATOMIC_TYPES_H
 #define ATMOIC_TYPES_H
 
+#include <cstdint>
+
 using FVal_t = double; // INPUT data type (the value of each feature)
 using Lab_t = double; // OUTPUT data type
+using FIdx_t = uint32_t; // feature index in the stored trees
 
 #endif // ATOMIC_TYPES_H
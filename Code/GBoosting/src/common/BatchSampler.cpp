@@ -0,0 +1,65 @@
+#include "BatchSampler.h"
+#include <algorithm>
+#include <stdexcept>
+
+
+BatchSampler::BatchSampler(const size_t rowCnt, const size_t batchSize,
+    const bool withReplacement, const unsigned int seed):
+    rowCnt(rowCnt), batchSize(batchSize), withReplacement(withReplacement),
+    generator(seed) {
+    if (batchSize == 0 || batchSize > rowCnt)
+        throw std::runtime_error("Batch size must be in [1; train length]");
+    // the geometric distribution needs p < 1 (all rows are taken otherwise)
+    if (batchSize < rowCnt)
+        gap = std::geometric_distribution<size_t>(
+            double(batchSize) / double(rowCnt));
+    if (withReplacement)
+        sums.resize(batchSize);
+}
+
+
+void BatchSampler::next(std::vector<size_t>& rows) {
+    if (withReplacement)
+        nextBagging(rows);
+    else
+        nextBernoulli(rows);
+}
+
+
+void BatchSampler::nextBernoulli(std::vector<size_t>& rows) {
+    rows.clear();
+    if (batchSize == rowCnt) {
+        for (size_t i = 0; i < rowCnt; ++i)
+            rows.push_back(i);
+        return;
+    }
+    // an empty batch is drawn again (it's rare for batchSize >= 1)
+    while (rows.empty()) {
+        size_t row = 0;
+        while (true) {
+            const size_t skip = gap(generator);
+            if (skip >= rowCnt - row)
+                break;
+            row += skip;
+            rows.push_back(row++);
+            if (row == rowCnt)
+                break;
+        }
+    }
+}
+
+
+void BatchSampler::nextBagging(std::vector<size_t>& rows) {
+    // sorted uniform values: the partial sums of the exponential
+    // spacings divided by the sum of all (batchSize + 1) spacings
+    double total = 0;
+    for (size_t i = 0; i < batchSize; ++i) {
+        total += spacing(generator);
+        sums[i] = total;
+    }
+    total += spacing(generator);
+    rows.resize(batchSize);
+    const double scale = double(rowCnt) / total;
+    for (size_t i = 0; i < batchSize; ++i)
+        rows[i] = std::min(rowCnt - 1, size_t(sums[i] * scale));
+}
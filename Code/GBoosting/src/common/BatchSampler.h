@@ -0,0 +1,41 @@
+#ifndef BATCH_SAMPLER_H_INCLUDED
+#define BATCH_SAMPLER_H_INCLUDED
+
+#include <cstddef>
+#include <random>
+#include <vector>
+
+
+// Random train rows for each tree in O(batch): the rows which aren't
+// chosen are skipped without being touched, the chosen ones come sorted
+// (the histograms and the leaf updates read the train data in order).
+// Without replacement each row is taken with the probability
+// batchSize / rowCnt (the gaps between the rows are geometric), so the
+// batch has batchSize rows on average. With replacement (bagging)
+// exactly batchSize rows are drawn, a row may be taken several times.
+// The sampler has its own generator (no global state), so the models
+// can be fitted from several threads at once
+class BatchSampler {
+public:
+    BatchSampler(const size_t rowCnt, const size_t batchSize,
+        const bool withReplacement, const unsigned int seed);
+
+    // the rows of the next batch (the vector is reused)
+    void next(std::vector<size_t>& rows);
+
+private:
+    // fields
+    size_t rowCnt;
+    size_t batchSize;
+    bool withReplacement;
+    std::mt19937_64 generator;
+    std::geometric_distribution<size_t> gap; // rows skipped before a row
+    std::exponential_distribution<double> spacing; // for the bagging
+    std::vector<double> sums; // helper for the bagging
+
+    // methods
+    inline void nextBernoulli(std::vector<size_t>& rows);
+    inline void nextBagging(std::vector<size_t>& rows);
+};
+
+#endif // BATCH_SAMPLER_H_INCLUDED
@@ -0,0 +1,44 @@
+#ifndef BINARY_MODEL_H_INCLUDED
+#define BINARY_MODEL_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+
+// Binary model file:
+// <Header><Features><Thresholds><Leaves>
+// Numbers are stored in the byte order of the writer (see byteOrder).
+// Each section starts at a multiple of sectionAlignment, so a mapped
+// file can be used for prediction without any parsing.
+// <Features> - FIdx_t[treeCnt * treeDepth]
+// <Thresholds> - FVal_t[treeCnt * innerNodes]
+// <Leaves> - Lab_t[treeCnt * leafCnt]
+struct BinaryModelHeader {
+    char magic[8]; // magicBytes
+    uint32_t version;
+    uint32_t byteOrder; // byteOrderMark
+    uint32_t modelType; // 0 for classification, 1 for regression
+    uint32_t featureIdxSize; // sizeof(FIdx_t)
+    uint32_t featureValSize; // sizeof(FVal_t)
+    uint32_t labelSize; // sizeof(Lab_t)
+    uint64_t featureCnt;
+    uint64_t treeCnt;
+    uint64_t treeDepth;
+    uint64_t featuresOffset;
+    uint64_t thresholdsOffset;
+    uint64_t leavesOffset;
+    uint64_t fileSize;
+    double zeroPredictor;
+    uint8_t reserved[32]; // zeros
+
+    // constants
+    static constexpr char magicBytes[8] = {'R', 'E', 'G', 'B', 'M', 'B', 'I', 'N'};
+    static constexpr uint32_t currentVersion = 1;
+    static constexpr uint32_t byteOrderMark = 0x01020304;
+    static constexpr size_t sectionAlignment = 64;
+};
+
+static_assert(sizeof(BinaryModelHeader) == 128,
+    "Binary model header must take 128 bytes");
+
+#endif // BINARY_MODEL_H_INCLUDED
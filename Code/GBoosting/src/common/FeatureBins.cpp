@@ -0,0 +1,31 @@
+#include "FeatureBins.h"
+
+#include <stdexcept>
+
+
+FeatureBins::FeatureBins(): sampleCnt(0), featureCnt(0),
+	binBytes(sizeof(uint8_t)) {}
+
+
+FeatureBins::FeatureBins(const size_t sampleCnt, const size_t featureCnt,
+	const size_t binCountMax): sampleCnt(sampleCnt), featureCnt(featureCnt) {
+	if (binCountMax > wideBinsMax)
+		throw std::runtime_error("Too many bins (max bin count is 65536)");
+	binBytes = (binCountMax <= narrowBinsMax)? sizeof(uint8_t) : sizeof(uint16_t);
+	data = std::vector<uint8_t>(sampleCnt * featureCnt * binBytes, 0);
+}
+
+
+size_t FeatureBins::getSampleCount() const {
+	return sampleCnt;
+}
+
+
+size_t FeatureBins::getFeatureCount() const {
+	return featureCnt;
+}
+
+
+bool FeatureBins::isWide() const {
+	return binBytes == sizeof(uint16_t);
+}
@@ -0,0 +1,50 @@
+#ifndef FEATURE_BINS_H
+#define FEATURE_BINS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+// Column-major matrix of the histogram bin indexes
+// (1st dim - feature number, 2nd dim - sample idx).
+// Indexes are stored in uint8_t if all bins fit into a byte,
+// otherwise in uint16_t
+class FeatureBins {
+public:
+	FeatureBins();
+	FeatureBins(const size_t sampleCnt, const size_t featureCnt,
+		const size_t binCountMax);
+
+	size_t getSampleCount() const;
+	size_t getFeatureCount() const;
+	bool isWide() const; // true if uint16_t is used for indexes
+
+	template <class Bin_t>
+	Bin_t* column(const size_t feature);
+	template <class Bin_t>
+	const Bin_t* column(const size_t feature) const;
+
+	// constants
+	static constexpr size_t narrowBinsMax = 256; // max bin count for uint8_t
+	static constexpr size_t wideBinsMax = 65536; // max bin count for uint16_t
+private:
+	size_t sampleCnt;
+	size_t featureCnt;
+	size_t binBytes; // sizeof of the bin index
+	std::vector<uint8_t> data;
+};
+
+
+template <class Bin_t>
+Bin_t* FeatureBins::column(const size_t feature) {
+	return reinterpret_cast<Bin_t*>(data.data() + feature * sampleCnt * binBytes);
+}
+
+
+template <class Bin_t>
+const Bin_t* FeatureBins::column(const size_t feature) const {
+	return reinterpret_cast<const Bin_t*>(data.data() + feature * sampleCnt * binBytes);
+}
+
+#endif // FEATURE_BINS_H
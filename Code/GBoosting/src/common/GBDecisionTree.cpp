@@ -2,6 +2,8 @@
 #include "StatisticsHelper.h"
 
 #include <stdexcept>
+#include <algorithm>
+#include <utility>
 #include <cstdlib>
 #include <cmath>
 
@@ -13,7 +15,8 @@ GBDecisionTree::GBDecisionTree(const size_t treesInEnsemble,
 	const Lab_t regularizationParam,
 	const bool spoilScores,
 	const float learningRate,
-	const size_t trainLen, const size_t depth): 
+	const size_t trainLen, const size_t depth,
+	std::shared_ptr<ThreadPool> threadPool): 
 	randWeight(1.0f),
 	weightDelta(2.0f / float(treesInEnsemble)),
 	regParam(regularizationParam),
@@ -21,8 +24,7 @@ GBDecisionTree::GBDecisionTree(const size_t treesInEnsemble,
 	treeDepth(depth), innerNodes((1 << treeDepth) - 1),
 	leafCnt(size_t(1) << treeDepth),
 	learningRate(learningRate),
-	subset(std::vector<std::vector<size_t>>(innerNodes + leafCnt,
-		std::vector<size_t>())) {
+	histStride(0), threadPool(threadPool) {
 		// checks
 		if (depth == 0)
 			throw std::runtime_error("Wrong tree depth");
@@ -33,6 +35,15 @@ GBDecisionTree::GBDecisionTree(const size_t treesInEnsemble,
 		// allocate memory for the thresholds array
 		curThreshold = std::vector<FVal_t>(leafCnt, 0);
 		bestThreshold = std::vector<FVal_t>(leafCnt, 0);
+		// node ranges in the sample indexes buffer
+		nodeBegin = std::vector<size_t>(innerNodes + leafCnt, 0);
+		nodeEnd = std::vector<size_t>(innerNodes + leafCnt, 0);
+		labelShift = std::vector<Lab_t>(innerNodes + leafCnt, 0);
+		histShift = std::vector<Lab_t>(innerNodes + leafCnt, 0);
+		nodeSqSum = std::vector<Lab_t>(innerNodes + leafCnt, 0);
+		sampleIdx.reserve(trainLen);
+		splitBuffer.reserve(trainLen);
+		rowLeaves = std::vector<uint32_t>(trainLen, TreeHolder::unknownLeaf);
 }
 
 
@@ -41,52 +52,100 @@ GBDecisionTree::~GBDecisionTree() {
 }
 
 
-void GBDecisionTree::growTree(const pytensor2& xTrain,
+template <class In_t>
+void GBDecisionTree::growTree(const MatrixView<const In_t>& xTrain,
+	const FeatureBins& bins,
 	const std::vector<size_t>& chosen, 
-	const pytensorY& yTrain,
+	const LVector& yTrain,
 	const std::vector<size_t>& featureSubset,
 	std::vector<GBHist>& hists,
-	std::shared_ptr<TreeHolder>& treeHolder) {
+	std::shared_ptr<TreeHolder>& treeHolder,
+	std::mt19937_64& generator) {
 	for (size_t i = 0; i < innerNodes; ++i)
 		thresholds[i] = 0;
 	for (size_t i = 0; i < leafCnt; ++i)
 		leaves[i] = 0;
-	pytensor2Y intermediateLabels = xt::zeros<Lab_t>({innerNodes + leafCnt, xTrain.shape(0)});
 
-	// 1st dim - node number, 2nd dim - sample idx
-	subset[0] = chosen;	
-	xt::row(intermediateLabels, 0) = yTrain;
+	// forget the leaves of the previous batch
+	for (const size_t idx : sampleIdx)
+		rowLeaves[idx] = TreeHolder::unknownLeaf;
+	// the root contains the whole batch
+	// children will be placed to the subranges of their parent
+	sampleIdx = chosen;
+	splitBuffer.resize(sampleIdx.size());
+	nodeBegin[0] = 0;
+	nodeEnd[0] = sampleIdx.size();
+	// labels of the root are yTrain, its hists are built around the mean
+	labelShift[0] = 0;
+	histShift[0] = StatisticsHelper::mean(yTrain, sampleIdx);
+	nodeSqSum[0] = StatisticsHelper::sqDeviation(yTrain, sampleIdx.data(),
+		sampleIdx.size(), histShift[0]);
 
 	featureCount = xTrain.shape(1);
 	size_t featureSubCount = featureSubset.size();
 
+	// allocate histograms for the widest level (the last one to split)
+	histStride = 0;
+	for (auto& feature : featureSubset)
+		histStride = std::max(histStride, hists[feature].getBinCount());
+	const size_t levelHistSize = (leafCnt / 2) * featureSubCount * histStride;
+	if (nodeHists.size() < levelHistSize) {
+		nodeHists.resize(levelHistSize);
+		childHists.resize(levelHistSize);
+	}
+	// best bins of the current level
+	// 1st dim - feature from subset, 2nd dim - node at the level
+	bestBins.resize(featureSubCount * (leafCnt / 2));
+	splitScores.resize(featureSubCount);
+
+	// root histograms (the only ones built on the whole batch)
+	histTasks.clear();
+	for (size_t curFeature = 0; curFeature < featureSubCount; ++curFeature) {
+		histTasks.push_back(HistTask{featureSubset[curFeature],
+			sampleIdx.data(), sampleIdx.size(), histShift[0],
+			nodeHist(nodeHists, 0, curFeature, featureSubCount)});
+	}
+	buildHists(bins, yTrain, hists);
+
 	size_t broCount = 1;
-	Lab_t bestScore;
-	bool firstSplitFound = false;
-	Lab_t curScore;
-	FVal_t atomicThreshold;
-	size_t bestFeature = 0;
 	for (size_t h = 0; h < treeDepth; ++h) {
-		// find best split
+		// find best split (of this level: the scores of the levels
+		// aren't comparable, each level takes its best feature)
+		Lab_t bestScore = 0;
+		bool firstSplitFound = false;
+		Lab_t curScore = 0;
+		size_t bestFeature = 0;
 		size_t firstBroNum = (1 << h) - 1;
-		for (size_t curFeature = 0; curFeature < featureSubCount; ++curFeature) {
+		// score all features in parallel
+		threadPool->parallelFor(featureSubCount, [&](const size_t curFeature) {
 			// for all nodes look for the best split of the feature
 			size_t feature = featureSubset[curFeature]; // get current feature from subset
-
-			curScore = 0;
+			Lab_t featureScore = 0;
 			for (size_t node = 0; node < broCount; ++node) {
 				// find best score
-				curScore += hists[feature].findBestSplit(xt::col(xTrain, feature),
-					subset[firstBroNum + node], 
-					xt::row(intermediateLabels, firstBroNum + node), atomicThreshold);
-				curThreshold[node] = atomicThreshold;
+				const size_t absoluteNode = firstBroNum + node;
+				featureScore += nodeSqSum[absoluteNode] + hists[feature].findBestSplit(
+					nodeHist(nodeHists, node, curFeature, featureSubCount),
+					histShift[absoluteNode] - labelShift[absoluteNode],
+					bestBins[curFeature * broCount + node]);
 			}
+			splitScores[curFeature] = featureScore;
+		});
+		// thresholds and score noise are random
+		// take them in the same order as in the single thread
+		for (size_t curFeature = 0; curFeature < featureSubCount; ++curFeature) {
+			size_t feature = featureSubset[curFeature]; // get current feature from subset
+			for (size_t node = 0; node < broCount; ++node) {
+				curThreshold[node] = hists[feature].getThreshold(
+					bestBins[curFeature * broCount + node], generator);
+			}
+			curScore = splitScores[curFeature];
 			// add random noise to the score
 			// this will make the chosen tree split to be
 			// not as optimal as it could be
 			// this diminishes overfitiing of the ensemble
 			if (spoilScores)
-				curScore = getSpoiledScore(curScore);
+				curScore = getSpoiledScore(curScore, generator);
 			if (!firstSplitFound || curScore < bestScore) {
 				bestScore = curScore;
 				cpyThresholds(); // bestThreshold = curThreshold
@@ -95,29 +154,81 @@ void GBDecisionTree::growTree(const pytensor2& xTrain,
 			}
 		}
 		// the best score is found now
-		// need to perform the split
-		for (size_t node = 0; node < broCount; ++node) {
-			std::vector<size_t> leftSubset;
-			std::vector<size_t> rightSubset;
+		// need to perform the split (nodes are independent)
+		threadPool->parallelFor(broCount, [&](const size_t node) {
 			size_t absoluteNode = firstBroNum + node;
 			thresholds[absoluteNode] = bestThreshold[node];
-			leftSubset = hists[bestFeature].performSplit(xt::col(xTrain, bestFeature),
-				subset[absoluteNode], bestThreshold[node], rightSubset);
-			// subset will be placed to their topological places
+			const size_t begin = nodeBegin[absoluteNode];
+			const size_t end = nodeEnd[absoluteNode];
+			const size_t leftSize = hists[bestFeature].performSplit(xTrain,
+				bestFeature, sampleIdx.data() + begin, end - begin,
+				bestThreshold[node], splitBuffer.data() + begin);
+			// subsets will be placed to their topological places
 			size_t leftSon = 2 * absoluteNode + 1;
 			size_t rightSon = leftSon + 1;
-			subset[leftSon] = leftSubset;
-			subset[rightSon] = rightSubset;
-			// update labels
-			Lab_t leftAvg = StatisticsHelper::mean(yTrain, leftSubset);
-			Lab_t rightAvg = StatisticsHelper::mean(yTrain, rightSubset);
-			xt::row(intermediateLabels, leftSon) = xt::zeros<Lab_t>(yTrain.shape());
-			xt::row(intermediateLabels, rightSon) = xt::zeros<Lab_t>(yTrain.shape());
-			for (size_t sample = 0; sample < yTrain.shape(0); ++sample) {
-				intermediateLabels(leftSon, sample) = intermediateLabels(absoluteNode, sample) - leftAvg;
-				intermediateLabels(rightSon, sample) = intermediateLabels(absoluteNode, sample) - rightAvg;
+			nodeBegin[leftSon] = begin;
+			nodeEnd[leftSon] = begin + leftSize;
+			nodeBegin[rightSon] = begin + leftSize;
+			nodeEnd[rightSon] = end;
+			// update labels: labels of the son are labels
+			// of the parent minus the son's mean residual
+			// (the hists of the son are built around this mean)
+			histShift[leftSon] = StatisticsHelper::mean(yTrain,
+				sampleIdx.data() + nodeBegin[leftSon], nodeSize(leftSon));
+			histShift[rightSon] = StatisticsHelper::mean(yTrain,
+				sampleIdx.data() + nodeBegin[rightSon], nodeSize(rightSon));
+			labelShift[leftSon] = labelShift[absoluteNode] + histShift[leftSon];
+			labelShift[rightSon] = labelShift[absoluteNode] + histShift[rightSon];
+			if (h + 1 < treeDepth) {
+				// the sons will be split
+				nodeSqSum[leftSon] = StatisticsHelper::sqDeviation(yTrain,
+					sampleIdx.data() + nodeBegin[leftSon], nodeSize(leftSon),
+					histShift[leftSon]);
+				nodeSqSum[rightSon] = StatisticsHelper::sqDeviation(yTrain,
+					sampleIdx.data() + nodeBegin[rightSon], nodeSize(rightSon),
+					histShift[rightSon]);
+			}
+		});
+		if (h + 1 < treeDepth) {
+			// histograms of the children: build the smaller one around
+			// the parent histShift, get the bigger one by subtraction,
+			// then shift both to the histShift of the children
+			histTasks.clear();
+			for (size_t node = 0; node < broCount; ++node) {
+				const size_t absoluteNode = firstBroNum + node;
+				const size_t smallSon = smallerSon(absoluteNode);
+				const size_t smallNode = 2 * node + (smallSon - (2 * absoluteNode + 1));
+				for (size_t curFeature = 0; curFeature < featureSubCount; ++curFeature) {
+					histTasks.push_back(HistTask{featureSubset[curFeature],
+						sampleIdx.data() + nodeBegin[smallSon], nodeSize(smallSon),
+						histShift[absoluteNode],
+						nodeHist(childHists, smallNode, curFeature, featureSubCount)});
+				}
 			}
+			buildHists(bins, yTrain, hists);
+			threadPool->parallelFor(broCount * featureSubCount, [&](const size_t task) {
+				const size_t node = task / featureSubCount;
+				const size_t curFeature = task % featureSubCount;
+				const size_t absoluteNode = firstBroNum + node;
+				const size_t smallSon = smallerSon(absoluteNode);
+				const size_t bigSon = 4 * absoluteNode + 3 - smallSon; // the other son
+				const size_t smallNode = 2 * node + (smallSon - (2 * absoluteNode + 1));
+				const size_t bigNode = 4 * node + 1 - smallNode;
+				const size_t binCount = hists[featureSubset[curFeature]].getBinCount();
+				BinStats* smallHist = nodeHist(childHists, smallNode,
+					curFeature, featureSubCount);
+				BinStats* bigHist = nodeHist(childHists, bigNode,
+					curFeature, featureSubCount);
+				GBHist::subtractHist(nodeHist(nodeHists, node, curFeature,
+					featureSubCount), smallHist, bigHist, binCount);
+				GBHist::shiftHist(smallHist, histShift[smallSon] - histShift[absoluteNode],
+					binCount);
+				GBHist::shiftHist(bigHist, histShift[bigSon] - histShift[absoluteNode],
+					binCount);
+			});
 		}
+		// children hists become the hists of the current level
+		std::swap(nodeHists, childHists);
 		features[h] = bestFeature;
 		broCount <<= 1;  // it equals *= 2
 	}
@@ -128,15 +239,20 @@ void GBDecisionTree::growTree(const pytensor2& xTrain,
 	// each leaf will be multiplied onto learning rate and regLeafUnit
 	for (size_t leaf = 0; leaf < leafCnt; ++leaf) {
 		curSum = 0;
-		curCnt = 0;
-		for (auto& sample : subset[innerNodes + leaf]) {
-			curSum += yTrain(sample);
+		curCnt = nodeSize(innerNodes + leaf);
+		const size_t end = nodeEnd[innerNodes + leaf];
+		for (size_t i = nodeBegin[innerNodes + leaf]; i < end; ++i) {
+			curSum += yTrain(sampleIdx[i]);
+			rowLeaves[sampleIdx[i]] = uint32_t(leaf);
 		}
-		curCnt = subset[innerNodes + leaf].size();
 		if (curCnt != 0)
 			leaves[leaf] = learningRate * curSum / (regParam + curCnt);  // mean leaf residual
 	}
-	validateTree();
+	if (!validateTree()) {
+		// the tree doesn't split the samples as the batch was split
+		for (const size_t idx : sampleIdx)
+			rowLeaves[idx] = TreeHolder::unknownLeaf;
+	}
 	// remember tree
 	treeHolder->newTree(features, thresholds, leaves);
 
@@ -150,15 +266,101 @@ void GBDecisionTree::removeRegularization() {
 }
 
 
-FVal_t GBDecisionTree::getSpoiledScore(const FVal_t splitScore) const {
+const std::vector<uint32_t>& GBDecisionTree::getRowLeaves() const {
+	return rowLeaves;
+}
+
+
+FVal_t GBDecisionTree::getSpoiledScore(const FVal_t splitScore,
+	std::mt19937_64& generator) const {
 	// generate random value in [0; 1)
-	float noise = float(std::rand()) / (float(1) + RAND_MAX);
+	float noise = std::uniform_real_distribution<float>(0, 1)(generator);
 	// rescale
 	noise *= scoreInRandNoiseMult * splitScore * randWeight;
 	return splitScore + noise;
 }
 
 
+size_t GBDecisionTree::nodeSize(const size_t node) const {
+	return nodeEnd[node] - nodeBegin[node];
+}
+
+
+size_t GBDecisionTree::smallerSon(const size_t node) const {
+	const size_t leftSon = 2 * node + 1;
+	return (nodeSize(leftSon) <= nodeSize(leftSon + 1))? leftSon : leftSon + 1;
+}
+
+
+void GBDecisionTree::buildHists(const FeatureBins& bins,
+	const LVector& yTrain, const std::vector<GBHist>& hists) {
+	// hists are independent, build them in parallel
+	// if there are less hists than threads, split big subsets into
+	// blocks with their own hists and sum the blocks afterwards
+	const size_t threadCnt = threadPool->getThreadCount();
+	const size_t taskCnt = histTasks.size();
+	const size_t maxBlocks = (threadCnt + taskCnt - 1) / std::max(taskCnt, size_t(1));
+	// 1st dim - task, 2nd dim - block
+	std::vector<size_t> firstBlock(taskCnt + 1, 0);
+	for (size_t i = 0; i < taskCnt; ++i) {
+		size_t blockCnt = std::min(maxBlocks, histTasks[i].subsetSize / minBlockSize);
+		firstBlock[i + 1] = firstBlock[i] + std::max(blockCnt, size_t(1));
+	}
+	const size_t allBlocks = firstBlock[taskCnt];
+	if (allBlocks == taskCnt) {
+		// one block per hist
+		threadPool->parallelFor(taskCnt, [&](const size_t i) {
+			const HistTask& task = histTasks[i];
+			hists[task.feature].buildHist(bins, task.feature, task.subset,
+				task.subsetSize, yTrain, task.labelShift, task.hist);
+		});
+		return;
+	}
+	if (blockHists.size() < allBlocks * histStride)
+		blockHists.resize(allBlocks * histStride);
+	threadPool->parallelFor(allBlocks, [&](const size_t block) {
+		// find the task of the block
+		const size_t i = std::upper_bound(firstBlock.begin(), firstBlock.end(),
+			block) - firstBlock.begin() - 1;
+		const HistTask& task = histTasks[i];
+		const size_t blockCnt = firstBlock[i + 1] - firstBlock[i];
+		const size_t blockNum = block - firstBlock[i];
+		const size_t blockSize = task.subsetSize / blockCnt;
+		const size_t bias = blockNum * blockSize;
+		// the last block may be bigger
+		const size_t curSize = (blockNum + 1 == blockCnt)?
+			(task.subsetSize - bias) : blockSize;
+		hists[task.feature].buildHist(bins, task.feature, task.subset + bias,
+			curSize, yTrain, task.labelShift,
+			(blockCnt == 1)? task.hist : (blockHists.data() + block * histStride));
+	});
+	// sum the blocks
+	threadPool->parallelFor(taskCnt, [&](const size_t i) {
+		const size_t blockCnt = firstBlock[i + 1] - firstBlock[i];
+		if (blockCnt == 1)
+			return; // built in place
+		const HistTask& task = histTasks[i];
+		const size_t binCount = hists[task.feature].getBinCount();
+		BinStats* blockHist = blockHists.data() + firstBlock[i] * histStride;
+		for (size_t bin = 0; bin < binCount; ++bin)
+			task.hist[bin] = blockHist[bin];
+		for (size_t blockNum = 1; blockNum < blockCnt; ++blockNum) {
+			blockHist += histStride;
+			for (size_t bin = 0; bin < binCount; ++bin) {
+				task.hist[bin].sum += blockHist[bin].sum;
+				task.hist[bin].size += blockHist[bin].size;
+			}
+		}
+	});
+}
+
+
+BinStats* GBDecisionTree::nodeHist(std::vector<BinStats>& levelHists,
+	const size_t node, const size_t curFeature, const size_t featureSubCount) const {
+	return levelHists.data() + (node * featureSubCount + curFeature) * histStride;
+}
+
+
 void GBDecisionTree::cpyThresholds() {
 	// copy curThreshold to the bestThreshold
 	for (size_t i = 0; i < leafCnt; ++i) {
@@ -167,10 +369,11 @@ void GBDecisionTree::cpyThresholds() {
 }
 
 
-void GBDecisionTree::validateTree() {
+bool GBDecisionTree::validateTree() {
+	bool splitsKept = true;
 	// NaNs
 	for (size_t i = 0; i < leafCnt; ++i) {
-		if (isnan(leaves[i])) {
+		if (std::isnan(leaves[i])) {
 			leaves[i] = 0;
 		}
 	}
@@ -179,13 +382,31 @@ void GBDecisionTree::validateTree() {
 	for (size_t i = 0; i < treeDepth; ++i) {
 		if (features[i] >= featureCount) {
 			features[i] = 0;
+			splitsKept = false;
 		}
 	}
 
 	// NaNs
 	for (size_t i = 0; i < innerNodes; ++i) {
-		if (isnan(thresholds[i])) {
+		if (std::isnan(thresholds[i])) {
 			thresholds[i] = 0;
+			splitsKept = false;
 		}
 	}
+	return splitsKept;
 }
+
+
+// the train sample types
+template void GBDecisionTree::growTree<double>(
+	const MatrixView<const double>& xTrain, const FeatureBins& bins,
+	const std::vector<size_t>& chosen, const LVector& yTrain,
+	const std::vector<size_t>& featureSubset, std::vector<GBHist>& hists,
+	std::shared_ptr<TreeHolder>& treeHolder,
+	std::mt19937_64& generator);
+template void GBDecisionTree::growTree<float>(
+	const MatrixView<const float>& xTrain, const FeatureBins& bins,
+	const std::vector<size_t>& chosen, const LVector& yTrain,
+	const std::vector<size_t>& featureSubset, std::vector<GBHist>& hists,
+	std::shared_ptr<TreeHolder>& treeHolder,
+	std::mt19937_64& generator);
@@ -1,12 +1,14 @@
 #ifndef GBDECISION_TREE_H
 #define GBDECISION_TREE_H
 
-#include "PybindHeader.h"
 #include "Structs.h"
 #include "GBHist.h"
+#include "FeatureBins.h"
 #include "TreeHolder.h"
+#include "ThreadPool.h"
 #include <vector>
 #include <memory>
+#include <random>
 
 
 // the class is helper (no instances needed)
@@ -16,20 +18,31 @@ public:
 		const Lab_t regularizationParam,
 		const bool spoilScores,
 		const float learningRate,
-		const size_t trainLen, const size_t depth);
+		const size_t trainLen, const size_t depth,
+		std::shared_ptr<ThreadPool> threadPool);
 
 	~GBDecisionTree();
 	
 	// growTree == FIT
-	void growTree(const pytensor2& xTrain,
+	// In_t is the type of the train samples: FVal_t or float
+	// (the random thresholds and the score noise are drawn from generator)
+	template <class In_t>
+	void growTree(const MatrixView<const In_t>& xTrain,
+		const FeatureBins& bins,
 		const std::vector<size_t>& chosen, 
-		const pytensorY& yTrain,
+		const LVector& yTrain,
 		const std::vector<size_t>& featureSubset,
 		std::vector<GBHist>& hists,
-		std::shared_ptr<TreeHolder>& treeHolder);
+		std::shared_ptr<TreeHolder>& treeHolder,
+		std::mt19937_64& generator);
 
 	void removeRegularization();
 
+	// leaves of the train rows of the last tree: the batch rows are
+	// already partitioned by the leaves, the others (and all rows if
+	// the splits were fixed by validation) are TreeHolder::unknownLeaf
+	const std::vector<uint32_t>& getRowLeaves() const;
+
 private:
 	// tree with depth 1 is node with 2 children
 	// leaves = 2 ** height
@@ -50,15 +63,58 @@ private:
 	size_t innerNodes;
 	size_t leafCnt;
 	float learningRate;
-	std::vector<std::vector<size_t>> subset;
+	// sample indexes of the batch, partitioned by the nodes:
+	// samples of the node are in [nodeBegin[node]; nodeEnd[node])
+	std::vector<size_t> sampleIdx;
+	std::vector<size_t> splitBuffer; // helper buffer to perform splits
+	std::vector<size_t> nodeBegin;
+	std::vector<size_t> nodeEnd;
+	// labels of the node are yTrain - labelShift[node]
+	std::vector<Lab_t> labelShift;
+	// histograms of the node are built on yTrain - histShift[node]
+	// (close to the node mean: the sums of the bins don't cancel)
+	std::vector<Lab_t> histShift;
+	// sum (yTrain - histShift[node])^2 over the node: the part of the
+	// split scores of the node which doesn't depend on the split
+	std::vector<Lab_t> nodeSqSum;
+	// histograms of the nodes of the current (next) tree level
+	// 1st dim - node at the level, 2nd dim - feature from subset, 3rd dim - bin
+	std::vector<BinStats> nodeHists;
+	std::vector<BinStats> childHists;
+	size_t histStride; // max bin count among the features
+	std::vector<size_t> bestBins; // best split bins of the level
+	std::vector<Lab_t> splitScores; // split scores of the level features
+	// histogram to build: the feature hist of the samples subset
+	struct HistTask {
+		size_t feature;
+		const size_t* subset;
+		size_t subsetSize;
+		Lab_t labelShift;
+		BinStats* hist;
+	};
+	std::vector<HistTask> histTasks;
+	std::vector<BinStats> blockHists; // partial hists of the subset blocks
+	std::vector<uint32_t> rowLeaves; // see getRowLeaves
+	std::shared_ptr<ThreadPool> threadPool;
 
 	// methods
-	inline FVal_t getSpoiledScore(const FVal_t splitScore) const;
+	inline FVal_t getSpoiledScore(const FVal_t splitScore,
+		std::mt19937_64& generator) const;
+	inline size_t nodeSize(const size_t node) const;
+	inline size_t smallerSon(const size_t node) const;
+	// build all hists from histTasks (in parallel)
+	void buildHists(const FeatureBins& bins, const LVector& yTrain,
+		const std::vector<GBHist>& hists);
+	inline BinStats* nodeHist(std::vector<BinStats>& levelHists,
+		const size_t node, const size_t curFeature,
+		const size_t featureSubCount) const;
 	inline void cpyThresholds(); // copy curThreshold to the bestThreshold
-	inline void validateTree();
+	// returns false if the splits were changed (not only the leaves)
+	inline bool validateTree();
 
 	// constants
 	static const float scoreInRandNoiseMult;
+	static constexpr size_t minBlockSize = 4096; // min subset block for a thread
 };
 
 #endif // GBDECISION_TREE_H
@@ -1,33 +1,47 @@
 #include "GBHist.h"
 #include "StatisticsHelper.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <limits>
 
 
+template <class In_t>
 GBHist::GBHist(const size_t binCountMin, const size_t binCountMax, 
-	const size_t treesInEnsemble, const pytensor1& xFeature,
-	const Lab_t regularizationParam, const bool randThreshold): 
+	const size_t treesInEnsemble, const VectorView<const In_t>& xFeature,
+	const Lab_t regularizationParam, const bool randThreshold,
+	std::shared_ptr<const QuantileSketch> sketch): 
 	binCount(binCountMin), binCountMin(binCountMin), 
-	binCountMax(binCountMax), itersGone(0),
+	binCountMax(binCountMax), itersGone(0), hasNan(false),
 	regularizationParam(regularizationParam),
-	randThreshold(randThreshold) {
+	randThreshold(randThreshold), sketch(sketch) {
 	size_t n = xFeature.shape(0); // data size
-	featureMin = xFeature(0); // at start
-	featureMax = featureMin;
-	for (size_t i = 1; i < n; ++i) { // find min and max
-		if (xFeature(i) < featureMin)
-			featureMin = xFeature(i);
-		if (xFeature(i) > featureMax)
-			featureMax = xFeature(i);
+	featureMin = 0; // if all samples are NaN
+	featureMax = 0;
+	bool firstValue = true;
+	for (size_t i = 0; i < n; ++i) { // find min and max (without NaNs)
+		const FVal_t sample = xFeature(i);
+		if (std::isnan(sample)) {
+			hasNan = true;
+			continue;
+		}
+		if (firstValue || sample < featureMin)
+			featureMin = sample;
+		if (firstValue || sample > featureMax)
+			featureMax = sample;
+		firstValue = false;
 	}
-	FVal_t binWidth = (featureMax - featureMin) / binCount;
-	FVal_t curThreshold;
-
-	for (size_t i = 0; i < binCount; ++i) {
-		curThreshold = (i + 1) * binWidth + featureMin; // compute threshold
-		thresholds.push_back(curThreshold); // remember threshold
+	// the net only grows, so the buffers are allocated once
+	thresholds.reserve(binCountMax);
+	for (size_t i = 0; i < binCount; ++i)
+		thresholds.push_back(gridThreshold(i)); // remember threshold
+	if (sketch != nullptr) {
+		borderQuantiles.reserve(binCountMax);
+		for (size_t i = 0; i < binCount; ++i)
+			borderQuantiles.push_back(double(i + 1) / binCount);
 	}
+	updateBinScale();
 	// Static bin count in histograms
 	if (binCountMin == binCountMax) {
 		itersToStopUpdate = 0; // don't update at all
@@ -48,36 +62,123 @@ GBHist::GBHist(const size_t binCountMin, const size_t binCountMax,
 		itersToUpdate = size_t(itersPerBinIncrement);
 	}
 	itersToStopUpdate = binDiff * (binCountMax - binCountMin) / itersToUpdate;
-	
-	// init helper arrays to find the optimal splits
-	binValue = std::vector<Lab_t>(binCount, 0);
-	binSize = std::vector<size_t>(binCount, 0);
 }
 
 
 size_t GBHist::getBinCount() const {
-	return binCount;
+	return binCount + size_t(hasNan);
+}
+
+
+size_t GBHist::getBinCountMax() const {
+	return binCountMax + size_t(hasNan);
+}
+
+
+template <class In_t>
+void GBHist::binarize(const MatrixView<const In_t>& xTrain,
+	const size_t feature, FeatureBins& bins) {
+	if (bins.isWide())
+		binarizeImpl(xTrain, feature, bins.column<uint16_t>(feature));
+	else
+		binarizeImpl(xTrain, feature, bins.column<uint8_t>(feature));
+}
+
+
+template <class In_t>
+void GBHist::refineBins(const MatrixView<const In_t>& xTrain,
+	const size_t feature, FeatureBins& bins) {
+	if (bins.isWide())
+		refineBinsImpl(xTrain, feature, bins.column<uint16_t>(feature));
+	else
+		refineBinsImpl(xTrain, feature, bins.column<uint8_t>(feature));
+}
+
+
+void GBHist::buildHist(const FeatureBins& bins, const size_t feature,
+	const size_t* subset, const size_t subsetSize,
+	const LVector& labels, const Lab_t labelShift,
+	BinStats* hist) const {
+	if (bins.isWide())
+		buildHistImpl(bins.column<uint16_t>(feature), subset, subsetSize,
+			labels, labelShift, hist);
+	else
+		buildHistImpl(bins.column<uint8_t>(feature), subset, subsetSize,
+			labels, labelShift, hist);
+}
+
+
+template <class In_t, class Bin_t>
+void GBHist::binarizeImpl(const MatrixView<const In_t>& xTrain,
+	const size_t feature, Bin_t* binsColumn) {
+	const size_t n = xTrain.shape(0);
+	binSizes.assign(binCount, 0);
+	for (size_t i = 0; i < n; ++i) {
+		const size_t bin = whichBin(xTrain(i, feature));
+		binsColumn[i] = Bin_t(bin);
+		if (bin < binCount)
+			++binSizes[bin]; // the NaN bin is never split
+	}
 }
 
 
-Lab_t GBHist::findBestSplit(const pytensor1& xData,
-	const std::vector<size_t>& subset, 
-	const pytensorY& labels, FVal_t& threshold) {
-	size_t nSub = subset.size(); // size of the subset
+template <class In_t, class Bin_t>
+void GBHist::refineBinsImpl(const MatrixView<const In_t>& xTrain,
+	const size_t feature, Bin_t* binsColumn) {
+	const size_t n = xTrain.shape(0);
+	binSizes.assign(binCount, 0);
+	for (size_t i = 0; i < n; ++i) {
+		const size_t oldBin = binsColumn[i];
+		if (oldBin + 1 == newFirstBin.size()) {
+			binsColumn[i] = Bin_t(binCount); // the NaN bin is the last one
+			continue;
+		}
+		size_t bin = newFirstBin[oldBin];
+		const size_t lastBin = newFirstBin[oldBin + 1] - 1;
+		if (bin != lastBin) {
+			// the bin was split: find the part
+			const FVal_t sample = xTrain(i, feature);
+			while (bin < lastBin && sample >= thresholds[bin])
+				++bin;
+		}
+		binsColumn[i] = Bin_t(bin);
+		++binSizes[bin];
+	}
+}
+
+
+template <class Bin_t>
+void GBHist::buildHistImpl(const Bin_t* binsColumn,
+	const size_t* subset, const size_t subsetSize,
+	const LVector& labels, const Lab_t labelShift,
+	BinStats* hist) const {
+	// use allocated array, but need to clean it first
+	const size_t histSize = getBinCount();
+	for (size_t i = 0; i < histSize; ++i)
+		hist[i] = BinStats{0, 0};
+	Lab_t curLabel = 0;
+	// map subset to bins
+	for (size_t i = 0; i < subsetSize; ++i) {
+		const size_t curX = subset[i];
+		BinStats& curBin = hist[binsColumn[curX]]; // bin of the current sample
+		curLabel = labels(curX) - labelShift;
+		curBin.sum += curLabel; // add value (compute sum)
+		++curBin.size; // to compute avg later
+	}
+}
 
-	// compute histograms
-	fillArraysWithNulls(); // use allocated arrays, but need to clean them first
-	size_t currentBin = 0;
 
+Lab_t GBHist::findBestSplit(const BinStats* hist, const Lab_t labelOffset,
+	size_t& bestBin) const {
 	Lab_t leftValue = 0;
 	Lab_t rightValue = 0;
+	size_t nSub = 0; // size of the subset
+	const size_t histSize = getBinCount();
 
-	// map subset to bins
-	for (auto& curX : subset) {
-		currentBin = whichBin(xData(curX)); // get bin number for the current sample		
-		binValue[currentBin] += labels(curX); // add value (compute sum)
-		++binSize[currentBin]; // to compute avg later
-		rightValue += labels(curX); // prepare for the best split searching
+	// prepare for the best split searching
+	for (size_t i = 0; i < histSize; ++i) {
+		rightValue += hist[i].sum;
+		nSub += hist[i].size;
 	}
 
 	// prepare to find the best split
@@ -92,17 +193,18 @@ Lab_t GBHist::findBestSplit(const pytensor1& xData,
 	size_t leftSize = 0;
 	size_t rightSize = nSub; // at start, all samples are in the right subset
 
-	for (size_t leftLastBin = 0; leftLastBin < binCount - 1; ++leftLastBin) {
+	for (size_t leftLastBin = 0; leftLastBin + 1 < histSize; ++leftLastBin) {
+		const BinStats& curBin = hist[leftLastBin];
 		// skip empty bins
-		if (binSize[leftLastBin] == 0) {
+		if (curBin.size == 0) {
 			continue;
 		}
 		// try add bin to the left subset
-		leftValue += binValue[leftLastBin]; // increase left subset score
-		rightValue -= binValue[leftLastBin]; // decrease right subset score
+		leftValue += curBin.sum; // increase left subset score
+		rightValue -= curBin.sum; // decrease right subset score
 
-		leftSize += binSize[leftLastBin]; // increase left subset size
-		rightSize -= binSize[leftLastBin]; // decrease right subset size
+		leftSize += curBin.size; // increase left subset size
+		rightSize -= curBin.size; // decrease right subset size
 
 		// compute current score in several steps
 		// step 1: compute leaves
@@ -111,30 +213,27 @@ Lab_t GBHist::findBestSplit(const pytensor1& xData,
 		// hessians are 1 (const)
 		// leftSize (rightSize) is the sum of the hessians
 		// leftValue (rightValue) is the sum of the gradients
-		Lab_t leftAvg = leftValue / (leftSize + regularizationParam);
+		// the leaves are computed minus labelOffset (as the hist labels):
+		// (sum + size * offset) / (size + reg) - offset
+		Lab_t leftAvg = (leftValue - regularizationParam * labelOffset) /
+			(leftSize + regularizationParam);
 		Lab_t rightAvg = 0;
 		if (rightSize != 0) {
-			rightAvg = rightValue / (rightSize + regularizationParam);
+			rightAvg = (rightValue - regularizationParam * labelOffset) /
+				(rightSize + regularizationParam);
 		} // else rightAvg = 0 (on init)
 		// avoid NaNs
-		if (isnan(leftAvg))
+		if (std::isnan(leftAvg))
 			leftAvg = 0;
-		if (isnan(rightAvg))
+		if (std::isnan(rightAvg))
 			rightAvg = 0;
 		// now leftAvg (rightAvg) is the leaf weight corresponding to the current node
 
-		// step 2: calculate RSS
-		FVal_t curThreshold = thresholds[leftLastBin];
-		leftScore = rightScore = 0; // init scores for sum
-		for (auto& curX : subset) {
-			if (xData(curX) < curThreshold) {
-				// increase left score
-				leftScore += square(leftAvg - labels(curX));
-			} else {
-				// increase right score
-				rightScore += square(rightAvg - labels(curX));
-			}
-		}
+		// step 2: calculate RSS from the prefix sums
+		// sum (avg - y)^2 = size * avg^2 - 2 * avg * sum(y) + sum(y^2),
+		// sum(y^2) of both parts is the same for all the splits
+		leftScore = rssWithoutSquares(leftAvg, leftValue, leftSize);
+		rightScore = rssWithoutSquares(rightAvg, rightValue, rightSize);
 		
 		// step 3: compute score
 		// score(split) = MSE_left + MSE_right (no weights needed)
@@ -148,6 +247,27 @@ Lab_t GBHist::findBestSplit(const pytensor1& xData,
 		}
 	}
 
+	if (firstIter && nSub != 0) {
+		// no split (all the samples are in the last bin): one leaf
+		Lab_t avg = (rightValue - regularizationParam * labelOffset) /
+			(nSub + regularizationParam);
+		if (std::isnan(avg))
+			avg = 0;
+		bestScore = rssWithoutSquares(avg, rightValue, nSub);
+	}
+
+	// return answers
+	bestBin = bestBinNumber;
+	return bestScore;
+}
+
+
+FVal_t GBHist::getThreshold(const size_t bestBinNumber,
+		std::mt19937_64& generator) const {
+	// all the values go left, NaN goes right
+	if (hasNan && bestBinNumber + 1 == binCount)
+		return std::numeric_limits<FVal_t>::infinity();
+	FVal_t threshold;
 	if (bestBinNumber != 0 && bestBinNumber != binCount - 1) {
 		// the bucket is somwhere in the middle on the histogram
 		// get random threshold from the interval <a, b>, where
@@ -156,7 +276,7 @@ Lab_t GBHist::findBestSplit(const pytensor1& xData,
 		if (randThreshold) {
 			// random threshold
 			threshold = randomFromInterval(thresholds[bestBinNumber - 1],
-				thresholds[bestBinNumber + 1]);
+				thresholds[bestBinNumber + 1], generator);
 		} else {
 			// deterministic threshold
 			threshold = thresholds[bestBinNumber];
@@ -164,76 +284,198 @@ Lab_t GBHist::findBestSplit(const pytensor1& xData,
 	} else
 		// it's the leftmost or the rightmost bucket
 		threshold = thresholds[bestBinNumber];
-	// return answers
-	return bestScore;
+	return threshold;
 }
 
 
-std::vector<size_t> GBHist::performSplit(const pytensor1& xData,
-	const std::vector<size_t>& subset, const FVal_t threshold, 
-	std::vector<size_t>& rightSubset) const {
-	std::vector<size_t> leftSubset;
-	rightSubset.clear();
-	for (auto& curIdx : subset) {
-		if (xData(curIdx) < threshold)
-			leftSubset.push_back(curIdx);
+template <class In_t>
+size_t GBHist::performSplit(const MatrixView<const In_t>& xTrain,
+	const size_t feature, size_t* subset, const size_t subsetSize,
+	const FVal_t threshold, size_t* buffer) const {
+	// left samples are moved to the start of the subset in place,
+	// right samples are collected in the buffer and copied after them
+	size_t leftSize = 0;
+	size_t rightSize = 0;
+	for (size_t i = 0; i < subsetSize; ++i) {
+		const size_t curIdx = subset[i];
+		if (xTrain(curIdx, feature) < threshold)
+			subset[leftSize++] = curIdx;
 		else
-			rightSubset.push_back(curIdx);
+			buffer[rightSize++] = curIdx;
+	}
+	std::copy(buffer, buffer + rightSize, subset + leftSize);
+	return leftSize;
+}
+
+
+void GBHist::subtractHist(const BinStats* parent, const BinStats* child,
+	BinStats* sibling, const size_t binCount) {
+	for (size_t i = 0; i < binCount; ++i) {
+		sibling[i].size = parent[i].size - child[i].size;
+		// avoid rounding errors in the empty bins
+		sibling[i].sum = (sibling[i].size == 0)? 0 :
+			parent[i].sum - child[i].sum;
+	}
+}
+
+
+void GBHist::shiftHist(BinStats* hist, const Lab_t delta,
+	const size_t binCount) {
+	for (size_t i = 0; i < binCount; ++i) {
+		if (hist[i].size == 0)
+			continue; // nothing to shift (delta may be NaN for empty nodes)
+		hist[i].sum -= delta * hist[i].size;
 	}
-	return leftSubset;
 }
 
 
-Lab_t GBHist::square(const Lab_t arg) {
-	return arg * arg;
+Lab_t GBHist::rssWithoutSquares(const Lab_t avg, const Lab_t sum,
+	const size_t size) {
+	return (avg * size - 2 * sum) * avg;
 }
 
 
 size_t GBHist::whichBin(const FVal_t& sample) const {
-	size_t bin = 0;
-	while (sample >= thresholds[bin] && bin < binCount - 1) {
+	if (sample < thresholds[0])
+		return 0;
+	// NaN has its own bin after the others: it is always in the right
+	// part of the split, as in performSplit (NaN < threshold is false)
+	if (std::isnan(sample))
+		return binCount;
+	if (binScale != 0)
+		return whichBinUniform(sample);
+	return whichBinSearch(sample);
+}
+
+
+size_t GBHist::whichBinUniform(const FVal_t& sample) const {
+	// O(1): the bin from the distance to the min, the rounding error
+	// is fixed by the neighbour thresholds
+	const FVal_t pos = (sample - featureMin) * binScale;
+	size_t bin = (pos < FVal_t(binCount - 1))? size_t(pos) : binCount - 1;
+	while (bin > 0 && sample < thresholds[bin - 1])
+		--bin;
+	while (bin < binCount - 1 && sample >= thresholds[bin])
 		++bin;
-	}
 	return bin;
 }
 
 
+size_t GBHist::whichBinSearch(const FVal_t& sample) const {
+	// branchless binary search over the first binCount - 1 thresholds
+	// (the loop depends only on the bin count)
+	const FVal_t* curThresholds = thresholds.data();
+	size_t first = 0;
+	size_t len = binCount - 1;
+	while (len > 0) {
+		const size_t half = len / 2;
+		const bool goRight = sample >= curThresholds[first + half];
+		first = goRight? (first + half + 1) : first;
+		len = goRight? (len - half - 1) : half;
+	}
+	return first;
+}
+
+
+void GBHist::updateBinScale() {
+	const FVal_t binWidth = (featureMax - featureMin) / binCount;
+	// quantile & degenerate (constant feature) grids use the search
+	binScale = (sketch == nullptr && binWidth > 0)? (1 / binWidth) : 0;
+}
+
+
 FVal_t GBHist::randomFromInterval(const FVal_t from,
-		const FVal_t to) {
-	return FVal_t(to - from) * FVal_t(rand()) / (FVal_t(1) + RAND_MAX) + from;
+		const FVal_t to, std::mt19937_64& generator) {
+	return std::uniform_real_distribution<FVal_t>(from, to)(generator);
 }
 
 
-void GBHist::updateThresholds() {
+bool GBHist::splitBins() {
 	if (binCount >= binCountMax)
-		return; // don't need recomputing
-	// recompute bin count
-	binCount += binDiff;
-	const size_t currentLength = thresholds.size();
-	const size_t tail = binCount - currentLength;
-	const FVal_t binWidth = (featureMax - featureMin) / binCount;
-	// update thresholds for the allocated part
-	for (size_t i = 0; i < currentLength; ++i) {
-		thresholds[i] = (i + 1) * binWidth + featureMin;
+		return false; // don't need recomputing
+	// new bin count (don't exceed the max bin count)
+	const size_t newBinCount = std::min(binCount + binDiff, binCountMax);
+	// each new bin goes to the old bin with the most samples per part,
+	// the old bin b will be split into pieces[b] equal parts
+	std::vector<size_t> pieces(binCount, 1);
+	auto lessParts = [this, &pieces](const size_t a, const size_t b) {
+		// sizes[a] / pieces[a] < sizes[b] / pieces[b] without the division
+		const size_t aScore = binSizes[a] * pieces[b];
+		const size_t bScore = binSizes[b] * pieces[a];
+		return (aScore != bScore)? (aScore < bScore) : (a > b);
+	};
+	std::vector<size_t> queue(binCount);
+	for (size_t i = 0; i < binCount; ++i)
+		queue[i] = i;
+	std::make_heap(queue.begin(), queue.end(), lessParts);
+	for (size_t i = binCount; i < newBinCount; ++i) {
+		std::pop_heap(queue.begin(), queue.end(), lessParts);
+		++pieces[queue.back()];
+		std::push_heap(queue.begin(), queue.end(), lessParts);
 	}
-	// add new thresholds
-	for (size_t i = 0; i < tail; ++i) {
-		thresholds.push_back((i + currentLength + 1) * binWidth + featureMin);
+	newFirstBin.resize(binCount + 1);
+	newFirstBin[0] = 0;
+	for (size_t i = 0; i < binCount; ++i)
+		newFirstBin[i + 1] = newFirstBin[i] + pieces[i];
+
+	// the old borders are kept, the parts of the bins are put between;
+	// go from the end, so the old borders are read before rewriting
+	// (the buffers have binCountMax capacity, so they grow in place)
+	const bool quantiles = (sketch != nullptr);
+	thresholds.resize(newBinCount);
+	if (quantiles)
+		borderQuantiles.resize(newBinCount);
+	for (size_t i = binCount; i-- > 0; ) {
+		const FVal_t right = thresholds[i];
+		const FVal_t left = (i == 0)? featureMin : thresholds[i - 1];
+		const double rightQ = quantiles? borderQuantiles[i] : 0;
+		const double leftQ = (quantiles && i != 0)? borderQuantiles[i - 1] : 0;
+		const size_t first = newFirstBin[i];
+		const size_t cnt = pieces[i];
+		thresholds[first + cnt - 1] = right;
+		if (quantiles)
+			borderQuantiles[first + cnt - 1] = rightQ;
+		for (size_t j = 1; j < cnt; ++j) {
+			if (quantiles) {
+				// equal sample parts
+				const double q = leftQ + (rightQ - leftQ) * j / cnt;
+				borderQuantiles[first + j - 1] = q;
+				thresholds[first + j - 1] = sketch->quantile(q);
+			} else {
+				// equal widths
+				thresholds[first + j - 1] = left + (right - left) * j / cnt;
+			}
+		}
 	}
-	// update helper arrays (they have to grow)
-	binValue = std::vector<Lab_t>(binCount, 0);
-	binSize = std::vector<size_t>(binCount, 0);
+	binCount = newBinCount;
+	binScale = 0; // the refined grid isn't uniform
+	return true;
 }
 
 
-void GBHist::updateNet() {
+FVal_t GBHist::gridThreshold(const size_t i) const {
+	if (sketch == nullptr) {
+		// uniform bins
+		const FVal_t binWidth = (featureMax - featureMin) / binCount;
+		return (i + 1) * binWidth + featureMin;
+	}
+	// the last bin ends with the max, the others hold equal sample parts
+	// (the borders of the rare values may coincide, such bins are empty)
+	if (i + 1 >= binCount)
+		return featureMax;
+	return sketch->quantile(double(i + 1) / binCount);
+}
+
+
+bool GBHist::updateNet() {
 	++itersGone;
 	if (itersGone > itersToStopUpdate) {
-		return;
+		return false;
 	}
 	if (itersGone % itersToUpdate == 0) {
-		updateThresholds();
+		return splitBins();
 	}
+	return false;
 }
 
 
@@ -242,17 +484,30 @@ void GBHist::removeRegularization() {
 }
 
 
-void GBHist::fillArraysWithNulls() {
-	if (binCount == binValue.size() &&
-		binCount == binSize.size()) {
-		for (size_t i = 0; i < binCount; ++i) {
-			binValue[i] = 0;
-			binSize[i] = 0;
-		}
-	}
-	else {
-		// TODO: use push_back instead
-		binValue = std::vector<Lab_t>(binCount, 0);
-		binSize = std::vector<size_t>(binCount, 0);
-	}
-}
+// the train sample types
+template GBHist::GBHist(const size_t binCountMin, const size_t binCountMax,
+	const size_t treesInEnsemble, const VectorView<const double>& xFeature,
+	const Lab_t regularizationParam, const bool randThreshold,
+	std::shared_ptr<const QuantileSketch> sketch);
+template GBHist::GBHist(const size_t binCountMin, const size_t binCountMax,
+	const size_t treesInEnsemble, const VectorView<const float>& xFeature,
+	const Lab_t regularizationParam, const bool randThreshold,
+	std::shared_ptr<const QuantileSketch> sketch);
+template void GBHist::binarize<double>(const MatrixView<const double>& xTrain,
+	const size_t feature, FeatureBins& bins);
+template void GBHist::binarize<float>(const MatrixView<const float>& xTrain,
+	const size_t feature, FeatureBins& bins);
+template void GBHist::refineBins<double>(
+	const MatrixView<const double>& xTrain, const size_t feature,
+	FeatureBins& bins);
+template void GBHist::refineBins<float>(
+	const MatrixView<const float>& xTrain, const size_t feature,
+	FeatureBins& bins);
+template size_t GBHist::performSplit<double>(
+	const MatrixView<const double>& xTrain, const size_t feature,
+	size_t* subset, const size_t subsetSize, const FVal_t threshold,
+	size_t* buffer) const;
+template size_t GBHist::performSplit<float>(
+	const MatrixView<const float>& xTrain, const size_t feature,
+	size_t* subset, const size_t subsetSize, const FVal_t threshold,
+	size_t* buffer) const;
@@ -1,26 +1,83 @@
 #ifndef GBHIST_H
 #define GBHIST_H
 
-#include "PybindHeader.h"
 #include "Structs.h"
+#include "FeatureBins.h"
+#include "QuantileSketch.h"
+#include <memory>
+#include <random>
 #include <vector>
 
 
+// sums over the samples that fell into a histogram bin
+// (the squared labels aren't needed, see findBestSplit)
+struct BinStats {
+	Lab_t sum; // sum of the labels
+	size_t size; // sample count
+};
+
+
+// In_t is the type of the train samples: FVal_t or float
+// (thresholds are FVal_t in both cases).
+// Bins are uniform between the feature min & max or, if the sketch
+// of the feature is given, hold equal parts of the samples (quantiles)
 class GBHist {
 public:
+	template <class In_t>
 	GBHist(const size_t binCountMin, const size_t binCountMax,
-		const size_t treesInEnsemble, const pytensor1& xFeature,
-		const Lab_t regularizationParam, const bool randThreshold);
+		const size_t treesInEnsemble, const VectorView<const In_t>& xFeature,
+		const Lab_t regularizationParam, const bool randThreshold,
+		std::shared_ptr<const QuantileSketch> sketch = nullptr);
 
+	// the bins of the values & the bin of NaN (if the feature has NaNs):
+	// it's the last one, NaN samples are always on the right of the splits
+	// (the split "all values | NaN" has the infinite threshold)
 	size_t getBinCount() const;
-	Lab_t findBestSplit(const pytensor1& xData,
-		const std::vector<size_t>& subset, 
-		const pytensorY& labels, FVal_t& threshold);
-	std::vector<size_t> performSplit(const pytensor1& xData,
-	const std::vector<size_t>& subset, const FVal_t threshold, 
-	std::vector<size_t>& rightSubset) const;
-	void updateNet(); // add 1 bin each M iterations
+	size_t getBinCountMax() const; // the NaN bin included
+	// put bin indexes of the feature to the bins matrix
+	template <class In_t>
+	void binarize(const MatrixView<const In_t>& xTrain, const size_t feature,
+		FeatureBins& bins);
+	// update bin indexes after updateNet (the old bins were split,
+	// only the samples of the split bins are compared with the thresholds)
+	template <class In_t>
+	void refineBins(const MatrixView<const In_t>& xTrain,
+		const size_t feature, FeatureBins& bins);
+	// fill hist (getBinCount() items) with the subset labels
+	// (label of the sample is labels(idx) - labelShift)
+	void buildHist(const FeatureBins& bins, const size_t feature,
+		const size_t* subset, const size_t subsetSize,
+		const LVector& labels, const Lab_t labelShift,
+		BinStats* hist) const;
+	// score (RSS) of the best split of the hist minus the sum of the
+	// squared hist labels: it's the same for all the splits of the node,
+	// the caller adds it (the sums of squares of the bins would cancel
+	// each other); thread-safe.
+	// The labels of the node are the hist labels + labelOffset
+	// (the hist is built around the node mean, so its sums are small)
+	Lab_t findBestSplit(const BinStats* hist, const Lab_t labelOffset,
+		size_t& bestBin) const;
+	// split threshold for the best bin (may be random)
+	FVal_t getThreshold(const size_t bestBin,
+		std::mt19937_64& generator) const;
+	// stable partition of the subset: left part first, then right part
+	// (x < threshold goes left, NaN goes right like in the prediction)
+	// returns the size of the left part
+	template <class In_t>
+	size_t performSplit(const MatrixView<const In_t>& xTrain,
+		const size_t feature, size_t* subset, const size_t subsetSize,
+		const FVal_t threshold, size_t* buffer) const;
+	// add binDiff bins each M iterations (true if net changed):
+	// the most populated bins are split, other borders are kept
+	bool updateNet();
 	void removeRegularization();
+
+	// sibling = parent - child
+	static void subtractHist(const BinStats* parent, const BinStats* child,
+		BinStats* sibling, const size_t binCount);
+	// hist of labels (y - delta) from hist of labels y
+	static void shiftHist(BinStats* hist, const Lab_t delta,
+		const size_t binCount);
 private:
 	size_t binCount;
 	size_t binCountMin;
@@ -29,21 +86,45 @@ private:
 	size_t itersToUpdate; // how many trees will be built with the current hist net
 	size_t itersToStopUpdate; // how many trees will be built until updates stop
 	size_t itersGone; // the current number of trees
+	bool hasNan; // there is the NaN bin (after binCount bins of the values)
 	FVal_t featureMin;
 	FVal_t featureMax;
 	Lab_t regularizationParam;
 	bool randThreshold;
+	std::shared_ptr<const QuantileSketch> sketch; // nullptr for uniform bins
 	std::vector<FVal_t> thresholds;
-	std::vector<Lab_t> binValue;
-	std::vector<size_t> binSize;
+	std::vector<double> borderQuantiles; // quantiles of the thresholds (if sketch)
+	FVal_t binScale; // 1 / bin width for the uniform bins, 0 otherwise
+	std::vector<size_t> binSizes; // train samples in each bin (without NaN)
+	// after the last split old bin b became [newFirstBin[b]; newFirstBin[b + 1])
+	std::vector<size_t> newFirstBin;
 
 	// functions
-	static inline Lab_t square(const Lab_t arg);
+	// sum (avg - y)^2 - sum y^2 over the samples of a part
+	static inline Lab_t rssWithoutSquares(const Lab_t avg, const Lab_t sum,
+		const size_t size);
 	static inline FVal_t randomFromInterval(const FVal_t from,
-		const FVal_t to);
+		const FVal_t to, std::mt19937_64& generator);
+	// the first bin which threshold is greater than the sample
+	// (the last bin if there is no such one, binCount for NaN)
 	inline size_t whichBin(const FVal_t& sample) const;
-	inline void updateThresholds();
-	inline void fillArraysWithNulls();
+	inline size_t whichBinUniform(const FVal_t& sample) const;
+	inline size_t whichBinSearch(const FVal_t& sample) const;
+	inline void updateBinScale();
+	// right border of the bin i for the current bin count
+	inline FVal_t gridThreshold(const size_t i) const;
+	template <class In_t, class Bin_t>
+	void binarizeImpl(const MatrixView<const In_t>& xTrain,
+		const size_t feature, Bin_t* binsColumn);
+	template <class In_t, class Bin_t>
+	void refineBinsImpl(const MatrixView<const In_t>& xTrain,
+		const size_t feature, Bin_t* binsColumn);
+	template <class Bin_t>
+	void buildHistImpl(const Bin_t* binsColumn,
+		const size_t* subset, const size_t subsetSize,
+		const LVector& labels, const Lab_t labelShift,
+		BinStats* hist) const;
+	inline bool splitBins();
 };
 
 #endif // GBHIST_H
@@ -9,17 +9,13 @@ GBPredictor::~GBPredictor() {
 
 GBPredictor::GBPredictor(const Lab_t zeroPredictor,
         const TreeHolder& treeHolder,
-        const pytensor2* xTrain,
-        const pytensor2* xValid,
-        pytensorY* residuals,
-        pytensorY* preds,
-        pytensorY* validRes,
-        pytensorY* validPreds):
-        trainLen((xTrain)? (xTrain->shape(0)) : (0)),
-        featureCount((xTrain)? (xTrain->shape(1)) : (0)),
-        validLen((xValid)? (xValid->shape(0)) : (0)),
+        const size_t featureCnt,
+        Labels* residuals,
+        Labels* preds,
+        Labels* validRes,
+        Labels* validPreds):
+        featureCount(featureCnt),
         zeroPredictor(zeroPredictor), treeHolder(treeHolder),
-        xTrain(xTrain), xValid(xValid),
         residuals(residuals), preds(preds),
         validRes(validRes), validPreds(validPreds) {
     // ctor
@@ -27,48 +23,76 @@ GBPredictor::GBPredictor(const Lab_t zeroPredictor,
 
 
 GBPredictor::GBPredictor(const Lab_t zeroPredictor, const TreeHolder& treeHolder,
-    const size_t featureCnt): trainLen(0), featureCount(featureCnt), validLen(0),
-    zeroPredictor(zeroPredictor), treeHolder(treeHolder),
-    xTrain(nullptr), xValid(nullptr), residuals(nullptr),
+    const size_t featureCnt): featureCount(featureCnt),
+    zeroPredictor(zeroPredictor), treeHolder(treeHolder), residuals(nullptr),
     preds(nullptr), validRes(nullptr), validPreds(nullptr) {
     // ctor
 }
 
 
-Lab_t GBPredictor::predict1d(const pytensor1& x) const {
+template <class In_t>
+Lab_t GBPredictor::predict1d(const VectorView<const In_t>& x) const {
     validateFeatureCount(x);
 	return zeroPredictor + treeHolder.predictAllTrees(x);
 }
 
 
-pytensorY GBPredictor::predict2d(const pytensor2& x) {
+template <class In_t>
+void GBPredictor::predict2d(const MatrixView<const In_t>& x,
+    Lab_t* answers) const {
     validateFeatureCount(x);
-    pytensorY answers = treeHolder.predictAllTrees2d(x);
+    treeHolder.predictAllTrees2d(x, answers);
     // don't forget zero predictor (constant)
-    for (size_t i = 0; i < answers.shape(0); ++i) {
-        answers(i) += zeroPredictor;
+    const size_t sampleCnt = x.shape(0);
+    for (size_t i = 0; i < sampleCnt; ++i) {
+        answers[i] += zeroPredictor;
     }
-    return answers;
 }
 
 
-void GBPredictor::predictTreeTrain(const size_t treeNum) {
-    if (xTrain == nullptr) {
+template <class In_t>
+void GBPredictor::predictTreeTrain(const MatrixView<const In_t>& xTrain,
+    const MatrixView<const In_t>& xValid, const size_t treeNum,
+    const uint32_t* trainLeaves) {
+    if (residuals == nullptr) {
         // it's the case we loaded model and don't need train
         throw std::runtime_error("Can't fit loaded model");
     }
-    treeHolder.predictTreeFit(*xTrain, *xValid, treeNum,
-        *residuals, *preds, *validRes, *validPreds);
+    treeHolder.predictTreeFit(xTrain, xValid, treeNum,
+        *residuals, *preds, *validRes, *validPreds, trainLeaves);
 }
 
 
-void GBPredictor::validateFeatureCount(const pytensor1& x) const {
+template <class In_t>
+void GBPredictor::validateFeatureCount(
+    const VectorView<const In_t>& x) const {
     if (x.shape(0) != featureCount)
 		throw std::runtime_error("Wrong feature count in x_test");
 }
 
 
-void GBPredictor::validateFeatureCount(const pytensor2& x) const {
+template <class In_t>
+void GBPredictor::validateFeatureCount(
+    const MatrixView<const In_t>& x) const {
     if (x.shape(1) != featureCount)
         throw std::runtime_error("Wrong feature count in x_test");
 }
+
+
+// the sample types
+template Lab_t GBPredictor::predict1d<double>(
+    const VectorView<const double>& x) const;
+template Lab_t GBPredictor::predict1d<float>(
+    const VectorView<const float>& x) const;
+template void GBPredictor::predict2d<double>(
+    const MatrixView<const double>& x, Lab_t* answers) const;
+template void GBPredictor::predict2d<float>(
+    const MatrixView<const float>& x, Lab_t* answers) const;
+template void GBPredictor::predictTreeTrain<double>(
+    const MatrixView<const double>& xTrain,
+    const MatrixView<const double>& xValid, const size_t treeNum,
+    const uint32_t* trainLeaves);
+template void GBPredictor::predictTreeTrain<float>(
+    const MatrixView<const float>& xTrain,
+    const MatrixView<const float>& xValid, const size_t treeNum,
+    const uint32_t* trainLeaves);
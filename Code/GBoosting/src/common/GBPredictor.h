@@ -1,21 +1,20 @@
 #ifndef GBPREDICTOR_H_INCLUDED
 #define GBPREDICTOR_H_INCLUDED
 
-#include "PybindHeader.h"
 #include "Structs.h"
 #include "TreeHolder.h"
 
 
 class GBPredictor {
 public:
+    // predictor for the fit (updates the residuals & predictions)
     GBPredictor(const Lab_t zeroPredictor,
         const TreeHolder& treeHolder,
-        const pytensor2* xTrain,
-        const pytensor2* xValid,
-        pytensorY* residuals,
-        pytensorY* preds,
-        pytensorY* validRes,
-        pytensorY* validPreds);
+        const size_t featureCnt,
+        Labels* residuals,
+        Labels* preds,
+        Labels* validRes,
+        Labels* validPreds);
 
     GBPredictor(const Lab_t zeroPredictor,
         const TreeHolder& treeHolder,
@@ -23,25 +22,32 @@ public:
 
     virtual ~GBPredictor();
 
-    Lab_t predict1d(const pytensor1& x) const;
-
-    pytensorY predict2d(const pytensor2& x);
-    void predictTreeTrain(const size_t treeNum);
+    // In_t is the type of the samples: FVal_t or float
+    template <class In_t>
+    Lab_t predict1d(const VectorView<const In_t>& x) const;
+
+    // answers must have x.shape(0) items
+    template <class In_t>
+    void predict2d(const MatrixView<const In_t>& x, Lab_t* answers) const;
+    // add the tree to the train & validation predictions,
+    // trainLeaves: see TreeHolder::predictTreeFit
+    template <class In_t>
+    void predictTreeTrain(const MatrixView<const In_t>& xTrain,
+        const MatrixView<const In_t>& xValid, const size_t treeNum,
+        const uint32_t* trainLeaves = nullptr);
 private:
-    const size_t trainLen;
-    const size_t validLen;
     const size_t featureCount;
     const Lab_t zeroPredictor;
     const TreeHolder& treeHolder;
-    const pytensor2* xTrain;
-    const pytensor2* xValid;
-    pytensorY* residuals;
-    pytensorY* preds;
-    pytensorY* validRes;
-    pytensorY* validPreds;
-
-    void validateFeatureCount(const pytensor1& x) const;
-    void validateFeatureCount(const pytensor2& x) const;
+    Labels* residuals;
+    Labels* preds;
+    Labels* validRes;
+    Labels* validPreds;
+
+    template <class In_t>
+    void validateFeatureCount(const VectorView<const In_t>& x) const;
+    template <class In_t>
+    void validateFeatureCount(const MatrixView<const In_t>& x) const;
 };
 
 #endif // GBPREDICTOR_H_INCLUDED
@@ -1,8 +1,13 @@
 #include "GBoosting.h"
 #include "StatisticsHelper.h"
 #include "ParseHelper.h"
+#include "BinaryModel.h"
+#include "MappedFile.h"
+#include "ModelWriter.h"
+#include "BatchSampler.h"
 
 #include <utility>
+#include <charconv>
 #include <stdexcept>
 #include <algorithm>
 #include <functional>
@@ -11,30 +16,35 @@
 #include <cmath>
 #include <fstream>
 #include <cstdio>
+#include <cstring>
+#include <random>
 
 
 GradientBoosting::GradientBoosting(const size_t binCountMin,
 	const size_t binCountMax, const size_t patience,
 	const bool dontUseEarlyStopping,
-	const size_t threadCnt): featureCount(1), 
+	const size_t threadCnt, const bool quantileBins): featureCount(1), 
 	trainLen(0), realTreeCount(0), binCountMin(binCountMin),
 	binCountMax(binCountMax), patience(patience), threadCnt(threadCnt),
-	zeroPredictor(0), dontUseEarlyStopping(dontUseEarlyStopping) {
+	zeroPredictor(0), dontUseEarlyStopping(dontUseEarlyStopping),
+	quantileBins(quantileBins) {
 	// ctor
 	if (binCountMax < binCountMin)
 		throw std::runtime_error("Max bin count was less than min bin count");
 	if (threadCnt == 0)
 		throw std::runtime_error("Thread count was 0 (must be positive)");
+	threadPool = std::make_shared<ThreadPool>(threadCnt);
 }
 
 GradientBoosting::~GradientBoosting() {
 	// dtor
 }
 
-History GradientBoosting::fit(const pytensor2& xTrain,
-	const pytensorY& yTrain, 
-	const pytensor2& xValid,
-	const pytensorY& yValid, const size_t treeCount,
+template <class In_t>
+History GradientBoosting::fit(const MatrixView<const In_t>& xTrain,
+	const LVector& yTrain, 
+	const MatrixView<const In_t>& xValid,
+	const LVector& yValid, const size_t treeCount,
 	const size_t treeDepth, const float featureSubsetPart,
 	const float learningRate,
 	const Lab_t regularizationParam,
@@ -44,21 +54,16 @@ History GradientBoosting::fit(const pytensor2& xTrain,
 	const bool randomBatches,
 	const bool randomThresholds,
 	const bool removeRegularizationLater,
-	const bool spoilScores) {
-	// Set random seed
-	std::srand(randomState);
+	const bool spoilScores,
+	const bool bootstrap) {
+	std::unique_lock<std::shared_mutex> lock(modelMutex);
+	// the random draws of the fit (no global state: the models
+	// can be fitted from several threads at once)
+	std::mt19937_64 generator(randomState);
 	// Prepare data	
 	trainLen = xTrain.shape(0);
 	featureCount = xTrain.shape(1);
 
-	if (xTrain.shape().size() != 2)
-		throw std::runtime_error("xTrain - wrong shape");
-	if (yTrain.shape().size() != 1)
-		throw std::runtime_error("yTrain - wrong shape");
-	if (xValid.shape().size() != 2)
-		throw std::runtime_error("xValid - wrong shape");
-	if (yValid.shape().size() != 1)
-		throw std::runtime_error("yValid - wrong shape");
 	if (yTrain.shape(0) != trainLen)
 		throw std::runtime_error("xTrain & yTrain sizes mismatch");
 	if (xValid.shape(0) != yValid.shape(0))
@@ -77,29 +82,51 @@ History GradientBoosting::fit(const pytensor2& xTrain,
 	// init tree holder
 	// call factory
 	treeHolder = std::make_shared<TreeHolder>(treeDepth, featureCount,
-		threadCnt);
-
+		threadPool);
+	treeHolder->setPredictBlocks(predictRowBlock, predictTreeBlock);
+
+	// quantile bins: one pass over each column (features in parallel)
+	std::vector<std::shared_ptr<const QuantileSketch>> sketches(featureCount);
+	if (quantileBins) {
+		threadPool->parallelFor(featureCount, [&](const size_t featureSlice) {
+			auto sketch = std::make_shared<QuantileSketch>(
+				sketchSizeMult * binCountMax);
+			const auto column = xTrain.col(featureSlice);
+			for (size_t i = 0; i < trainLen; ++i)
+				sketch->push(column(i));
+			sketch->flush();
+			sketches[featureSlice] = sketch;
+		});
+	}
 	// Histogram init (compute and remember thresholds)
+	hists.clear();
 	for (size_t featureSlice = 0; featureSlice < featureCount; ++featureSlice)
 		hists.push_back(GBHist(binCountMin, binCountMax, 
-			treeCount, xt::col(xTrain, featureSlice), 
-			regularizationParam, randomThresholds));
+			treeCount, xTrain.col(featureSlice), 
+			regularizationParam, randomThresholds, sketches[featureSlice]));
+	// quantize the train data once (histograms will use only bin indexes)
+	size_t binIndexMax = binCountMax; // NaN bins make it greater
+	for (const auto& curHist : hists)
+		binIndexMax = std::max(binIndexMax, curHist.getBinCountMax());
+	featureBins = FeatureBins(trainLen, featureCount, binIndexMax);
+	for (size_t featureSlice = 0; featureSlice < featureCount; ++featureSlice)
+		hists[featureSlice].binarize(xTrain, featureSlice, featureBins);
 	// fit ensemble
 
 	// fit the constant model
 	zeroPredictor = StatisticsHelper::mean(yTrain);
 
 	// fit another models
-	pytensorY residuals = xt::zeros<Lab_t>({trainLen});
-	pytensorY preds = xt::zeros<Lab_t>({trainLen});
-	pytensorY validRes = xt::zeros<Lab_t>({yValid.shape(0)});
-	pytensorY validPreds = xt::zeros<Lab_t>({yValid.shape(0)});
+	Labels residuals(trainLen, 0);
+	Labels preds(trainLen, 0);
+	Labels validRes(yValid.shape(0), 0);
+	Labels validPreds(yValid.shape(0), 0);
 	Lab_t trainLoss;
 	Lab_t validLoss;
 	// residuals = yTest - trainPreds
 	for (size_t i = 0; i < trainLen; ++i) {
-		residuals(i) = yTrain(i) - zeroPredictor;
-		preds(i) = zeroPredictor;
+		residuals[i] = yTrain(i) - zeroPredictor;
+		preds[i] = zeroPredictor;
 	}
 
 	trainLoss = loss(preds, yTrain);  // update loss
@@ -107,26 +134,28 @@ History GradientBoosting::fit(const pytensor2& xTrain,
 	// validation residuals
 	size_t validLen = yValid.size();
 	for (size_t i = 0; i < validLen; ++i) {
-		validRes(i) = yValid(i) - zeroPredictor;
-		validPreds(i) = zeroPredictor;
+		validRes[i] = yValid(i) - zeroPredictor;
+		validPreds[i] = zeroPredictor;
 	}
 	validLoss = loss(validPreds, yValid);  // update loss
 	
 	// create predictor
 	predictor = std::make_shared<GBPredictor>(GBPredictor(zeroPredictor, *treeHolder,
-		&xTrain, &xValid, &residuals, &preds, &validRes, &validPreds));
+		featureCount, &residuals, &preds, &validRes, &validPreds));
 	if (predictor == nullptr)
 		throw std::runtime_error("Can't fit: not enough memory");
 
 	// remember losses
 	// treeCount + 1 -- to include zero predictor
-	trainLosses = xt::zeros<Lab_t>({treeCount + 1});
-	validLosses = xt::zeros<Lab_t>({treeCount + 1});
-	trainLosses(0) = trainLoss;
-	validLosses(0) = validLoss;
+	trainLosses = Labels(treeCount + 1, 0);
+	validLosses = Labels(treeCount + 1, 0);
+	trainLosses[0] = trainLoss;
+	validLosses[0] = validLoss;
 
 	// default subset: all data
 	batchSize = size_t(batchPart * trainLen);
+	if (batchSize == 0)
+		throw std::runtime_error("batch part was too small (the batch was empty)");
 	std::vector<size_t> subset = getOrderedIndexes(batchSize);
 	// defalt feature subset: all features
 	size_t featureSubsetSize = (size_t)round(featureSubsetPart * float(featureCount));
@@ -135,10 +164,13 @@ History GradientBoosting::fit(const pytensor2& xTrain,
 		featureSubset[i] = i;
 	
 	GBDecisionTree treeFitter(treeCount, regularizationParam,
-		spoilScores, learningRate, trainLen, treeDepth);
+		spoilScores, learningRate, trainLen, treeDepth, threadPool);
 	bool stop = false;
 
-	initForRandomBatches(randomState);
+	// random batches: O(batch) per tree, the rows come sorted
+	// (seeded from the fit generator, the streams don't repeat each other)
+	BatchSampler sampler(trainLen, batchSize, bootstrap,
+		(unsigned int)(generator()));
 
 	// calculate when remove regularization
 	const size_t regularizationKillIter = (size_t)round(float(treeCount) * whenRemoveRegularization);
@@ -158,23 +190,25 @@ History GradientBoosting::fit(const pytensor2& xTrain,
 			nextBatch(subset);
 		else
 			// get random indexes
-			nextBatchRandom(subset);
+			sampler.next(subset);
 		// take the next feature subset (updates feature subset)
 		nextFeatureSubset(featureSubsetSize, featureCount,
 			featureSubset);
 		// grow & compile tree
-		treeFitter.growTree(xTrain, subset, residuals, featureSubset,
-			hists, treeHolder);
-		// update residuals
-		predictor->predictTreeTrain(treeNum);
+		treeFitter.growTree(xTrain, featureBins, subset, LVector(residuals), featureSubset,
+			hists, treeHolder, generator);
+		// update residuals (the batch rows take the leaves
+		// from the tree partition)
+		predictor->predictTreeTrain(xTrain, xValid, treeNum,
+			treeFitter.getRowLeaves().data());
 		
 		// update losses
 		trainLoss = loss(preds, yTrain);
 		validLoss = loss(validPreds, yValid);
 		
 		// remember losses
-		trainLosses(treeNum + 1) = trainLoss;
-		validLosses(treeNum + 1) = validLoss;
+		trainLosses[treeNum + 1] = trainLoss;
+		validLosses[treeNum + 1] = validLoss;
 
 		// update losses difference
 		if (!dontUseEarlyStopping) {
@@ -185,8 +219,12 @@ History GradientBoosting::fit(const pytensor2& xTrain,
 		}
 
 		// update historgrams' nets (bin counts)
-		for (auto & curHist : hists)
-			curHist.updateNet();
+		// bins are split, so only the indexes of the feature are updated
+		// (features are independent, update them in parallel)
+		threadPool->parallelFor(featureCount, [&](const size_t featureSlice) {
+			if (hists[featureSlice].updateNet())
+				hists[featureSlice].refineBins(xTrain, featureSlice, featureBins);
+		});
 	}
 	if (!dontUseEarlyStopping && stop) {
 		// need delete the last overfitted estimators
@@ -195,21 +233,40 @@ History GradientBoosting::fit(const pytensor2& xTrain,
 		}
 	}
 	realTreeCount = treeHolder->getTreeCount();
+	// the trees are interpreted if the code can't be emitted
+	treeHolder->emitNative();
 	return History(realTreeCount, trainLosses, validLosses);
 }
 
-Lab_t GradientBoosting::predict(const pytensor1& xTest) const {
+template <class In_t>
+Lab_t GradientBoosting::predict(const VectorView<const In_t>& xTest) const {
+	std::shared_lock<std::shared_mutex> lock(modelMutex);
+	validateFitted();
 	return predictor->predict1d(xTest);
 }
 
-pytensorY GradientBoosting::predict(const pytensor2& xTest) const {
-	return predictor->predict2d(xTest);
+template <class In_t>
+Labels GradientBoosting::predict(const MatrixView<const In_t>& xTest) const {
+	Labels answers(xTest.shape(0), 0);
+	predict(xTest, answers.data());
+	return answers;
+}
+
+template <class In_t>
+void GradientBoosting::predict(const MatrixView<const In_t>& xTest,
+	Lab_t* answers) const {
+	std::shared_lock<std::shared_mutex> lock(modelMutex);
+	validateFitted();
+	predictor->predict2d(xTest, answers);
 }
 
 
-Lab_t GradientBoosting::predictFromTo(const pytensor1& xTest, 
+template <class In_t>
+Lab_t GradientBoosting::predictFromTo(const VectorView<const In_t>& xTest, 
 	// TODO: use predictor instead
 	const size_t firstEstimator, const size_t lastEstimator) const {
+	std::shared_lock<std::shared_mutex> lock(modelMutex);
+	validateFitted();
 	Lab_t curPred = 0;
 	size_t from = firstEstimator;
 	if (xTest.shape(0) != featureCount)
@@ -226,9 +283,33 @@ Lab_t GradientBoosting::predictFromTo(const pytensor1& xTest,
 }
 
 
-void GradientBoosting::saveModel(const std::string& fname) const {
+void GradientBoosting::setPredictBlocks(const size_t rowBlock,
+	const size_t treeBlock) {
+	std::unique_lock<std::shared_mutex> lock(modelMutex);
+	predictRowBlock = rowBlock;
+	predictTreeBlock = treeBlock;
+	if (treeHolder != nullptr)
+		treeHolder->setPredictBlocks(rowBlock, treeBlock);
+}
+
+
+void GradientBoosting::compileJit(const std::string& cacheDir) {
+	std::unique_lock<std::shared_mutex> lock(modelMutex);
+	validateFitted();
+	treeHolder->compileJit(cacheDir);
+}
+
+
+void GradientBoosting::saveModel(const std::string& fname,
+	const bool binary) const {
+	std::shared_lock<std::shared_mutex> lock(modelMutex);
+	validateFitted();
+	if (binary) {
+		saveBinary(fname);
+		return;
+	}
 	// Save file structure:
-	// <Type><d><FeatureCnt><d><TreeCount><d><TreeDepth><d><zeroPredictor><d><Trees><e>
+	// <Type><d><FeatureCnt><d><TreeCount><d><TreeDepth><d><zeroPredictor><d><Trees><e><Checksum>
 	// <Type> ::= 0 | 1  # 0 for classification, 1 for regression
 	// <Trees> ::= <Tree> | <Tree><d><Trees>
 	// <Tree> ::= <Features><d><Thresholds><d><Leaves>
@@ -240,32 +321,36 @@ void GradientBoosting::saveModel(const std::string& fname) const {
 	// <Leaf> ::= <Lab_t number>
 	// <d> ::= ;  # delimeter
 	// <e> ::= !  # end
+	// <Checksum> ::= 16 hex digits of FNV-1a of all symbols up to <e>
 	
-	std::string contents;
 	static const char delimeter = ';';
 	static const char modelEnd = '!';
-	// try open file to write
-	// if file does not exist, an exception will be thrown
-	std::ofstream outfile(fname);
+	// the contents go to the file by chunks
+	ModelWriter writer(fname);
 	// <Type><d>
-	contents += std::to_string(modelType) + delimeter;
+	writer.writeSizeT(modelType);
+	writer.write(delimeter);
 	// <FeatureCnt><d>
-	contents += std::to_string(featureCount) + delimeter;
+	writer.writeSizeT(featureCount);
+	writer.write(delimeter);
 	// <TreeCount><d><TreeDepth><d><zeroPredictor><d><Trees>
-	contents += treeHolder->serialize(delimeter, zeroPredictor);
-	// <e>
-	contents += modelEnd;
-	// now contents are created properly
-	// write the contents to the file with a single operation
-	outfile << contents;
-	outfile.close();
+	treeHolder->serialize(writer, delimeter, zeroPredictor);
+	// <e><Checksum>
+	writer.write(modelEnd);
+	writer.writeChecksum();
+	writer.close();
 }
 
 
 GradientBoosting::GradientBoosting(const std::string& fname,
-	const size_t threadCnt): threadCnt(threadCnt) {	
+	const size_t threadCnt): threadCnt(threadCnt) {
+	threadPool = std::make_shared<ThreadPool>(threadCnt);
+	if (isBinaryModel(fname)) {
+		loadBinary(fname);
+		return;
+	}
 	// File structure:
-	// <Type><d><FeatureCnt><d><TreeCount><d><TreeDepth><d><zeroPredictor><d><Trees><e>
+	// <Type><d><FeatureCnt><d><TreeCount><d><TreeDepth><d><zeroPredictor><d><Trees><e><Checksum>
 	// <Type> ::= 0 | 1  # 0 for classification, 1 for regression
 	// <Trees> ::= <Tree> | <Tree><d><Trees>
 	// <Tree> ::= <Features><d><Thresholds><d><Leaves>
@@ -277,6 +362,8 @@ GradientBoosting::GradientBoosting(const std::string& fname,
 	// <Leaf> ::= <Lab_t number>
 	// <d> ::= ;  # delimeter
 	// <e> ::= !  # end
+	// <Checksum> ::= 16 hex digits of FNV-1a of all symbols up to <e>
+	// (optional, older models have none)
 	static const char delimeter = ';';
 	static const char modelEnd = '!';
 	FILE* pFile = fopen(fname.c_str(), "r");
@@ -319,28 +406,53 @@ GradientBoosting::GradientBoosting(const std::string& fname,
 		free(contents);
 		throw std::runtime_error("Can't load model: invalid file");
 	}
+	// verify the checksum if there is something after <e>
+	const size_t checkedSize = delimPositions.back() + 1;
+	if (contents[checkedSize - 1] == modelEnd && checkedSize < fileSize) {
+		const char* footer = contents + checkedSize;
+		uint64_t savedHash = 0;
+		std::from_chars_result res = std::from_chars(footer,
+			contents + fileSize, savedHash, 16);
+		if (res.ec != std::errc() ||
+			size_t(res.ptr - footer) != ModelWriter::checksumLen ||
+			savedHash != ModelWriter::checksum(contents, checkedSize)) {
+			free(contents);
+			throw std::runtime_error("Can't load model: checksum mismatch");
+		}
+	}
 
 	// step 2: parse initial info for the tree holder
 	// we will take each time the next symbol to the delimeter
     const char* nextSym = contents + 1;
+	const char* contentsEnd = contents + fileSize;
     size_t curDelimeterIdx = 0; // skip <Type>
-	featureCount = ParseHelper::parseSizeT(nextSym + delimPositions[curDelimeterIdx++]);
-    realTreeCount = ParseHelper::parseSizeT(nextSym + delimPositions[curDelimeterIdx++]);
-    size_t treeDepth = ParseHelper::parseSizeT(nextSym + delimPositions[curDelimeterIdx++]);	 
-	if (!valCptContents(delimPositions, modelEnd, contents,
-		realTreeCount, treeDepth, dPosMinSize)) {
+	try {
+		featureCount = ParseHelper::parseSizeT(nextSym + delimPositions[curDelimeterIdx++],
+			contentsEnd);
+		realTreeCount = ParseHelper::parseSizeT(nextSym + delimPositions[curDelimeterIdx++],
+			contentsEnd);
+		size_t treeDepth = ParseHelper::parseSizeT(nextSym + delimPositions[curDelimeterIdx++],
+			contentsEnd);
+		if (!valCptContents(delimPositions, modelEnd, contents,
+			realTreeCount, treeDepth, dPosMinSize))
+			throw std::runtime_error("Can't load model: invalid file");
+		zeroPredictor = (Lab_t)ParseHelper::parseFloat(nextSym + delimPositions[curDelimeterIdx++],
+			contentsEnd);
+
+		treeHolder = std::shared_ptr<TreeHolder>(TreeHolder::parse(nextSym, contentsEnd,
+			delimPositions, curDelimeterIdx, featureCount, realTreeCount, treeDepth,
+			threadPool));
+	} catch (...) {
 		free(contents);
-		throw std::runtime_error("Can't load model: invalid file");
+		throw;
 	}
-    zeroPredictor = (Lab_t)ParseHelper::parseFloat(nextSym + delimPositions[curDelimeterIdx++]);
-
-	treeHolder = std::shared_ptr<TreeHolder>(TreeHolder::parse(nextSym, delimPositions, curDelimeterIdx,
-		featureCount, realTreeCount, treeDepth, threadCnt));
 	
 	free(contents);
 	// check result
 	if (treeHolder == nullptr)
 		throw std::runtime_error("Not enough memory to load model");
+	treeHolder->setPredictBlocks(predictRowBlock, predictTreeBlock);
+	treeHolder->emitNative();
 	predictor = std::make_shared<GBPredictor>(zeroPredictor, *treeHolder,
 		featureCount);
 	if (predictor == nullptr) {
@@ -350,14 +462,67 @@ GradientBoosting::GradientBoosting(const std::string& fname,
 }
 
 
-Lab_t GradientBoosting::loss(const pytensorY& pred,
-	const pytensorY& truth) {
+void GradientBoosting::saveBinary(const std::string& fname) const {
+	// see BinaryModel.h for the file structure
+	BinaryModelHeader header = {};
+	std::memcpy(header.magic, BinaryModelHeader::magicBytes,
+		sizeof(header.magic));
+	header.modelType = modelType;
+	header.zeroPredictor = zeroPredictor;
+	std::ofstream outfile(fname, std::ios::binary);
+	if (!outfile)
+		throw std::runtime_error("Can't open the file");
+	// the tree holder fills the rest of the header
+	treeHolder->writeBinary(outfile, header);
+	outfile.close();
+}
+
+
+bool GradientBoosting::isBinaryModel(const std::string& fname) {
+	char magic[sizeof(BinaryModelHeader::magicBytes)];
+	FILE* pFile = fopen(fname.c_str(), "rb");
+	if (pFile == nullptr)
+		throw std::runtime_error("Can't open the file");
+	size_t symsRead = fread(magic, sizeof(char), sizeof(magic), pFile);
+	fclose(pFile);
+	return symsRead == sizeof(magic) &&
+		std::memcmp(magic, BinaryModelHeader::magicBytes, sizeof(magic)) == 0;
+}
+
+
+void GradientBoosting::loadBinary(const std::string& fname) {
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(fname);
+	if (file->size() < sizeof(BinaryModelHeader))
+		throw std::runtime_error("Can't load model: invalid file");
+	// copy the header (the first section is aligned anyway)
+	BinaryModelHeader header;
+	std::memcpy(&header, file->data(), sizeof(BinaryModelHeader));
+	if (header.byteOrder != BinaryModelHeader::byteOrderMark)
+		throw std::runtime_error("Can't load model: wrong byte order");
+	if (header.version != BinaryModelHeader::currentVersion)
+		throw std::runtime_error("Can't load model: unsupported version");
+	if (header.modelType != modelType)
+		throw std::runtime_error("Can't load model: wrong model type");
+	treeHolder = std::shared_ptr<TreeHolder>(TreeHolder::fromMapped(file,
+		header, threadPool));
+	featureCount = header.featureCnt;
+	realTreeCount = header.treeCnt;
+	zeroPredictor = (Lab_t)header.zeroPredictor;
+	treeHolder->setPredictBlocks(predictRowBlock, predictTreeBlock);
+	treeHolder->emitNative();
+	predictor = std::make_shared<GBPredictor>(zeroPredictor, *treeHolder,
+		featureCount);
+}
+
+
+Lab_t GradientBoosting::loss(const Labels& pred,
+	const LVector& truth) {
 	// 0.5 * MSE
 	size_t count = pred.size();
 	Lab_t squaredErrorSum = 0;
 	Lab_t res = 0;
 	for (size_t i = 0; i < count; ++i) {
-		res = pred(i) - truth(i);
+		res = pred[i] - truth(i);
 		squaredErrorSum += (res * res) / 2;
 	}
 	return squaredErrorSum / count;
@@ -371,7 +536,7 @@ bool GradientBoosting::canStop(const size_t stepNum,
 	}
 	else {
 		for (size_t i = stepNum - patience + 1; i <= stepNum; ++i) {
-			if (validLosses(i) - validLosses(i - 1) < -earlyStoppingDelta)
+			if (validLosses[i] - validLosses[i - 1] < -earlyStoppingDelta)
 				return false;
 		}
 		return true;
@@ -387,26 +552,6 @@ void GradientBoosting::nextBatch(std::vector<size_t>& allocatedSubset) const {
 }
 
 
-void GradientBoosting::nextBatchRandom(std::vector<size_t>& allocatedSubset) {
-	// all indexes are splitted into M folds
-	// we need to take only one sample from each fold
-	// to have subset of size equals batchSize
-	// foldCount == batchSize
-	
-	// shuffle indexes
-	std::shuffle(std::begin(shuffledIndexes), 
-		std::end(shuffledIndexes), randGenerator);
-	
-	size_t chosenIdx = 0; // init
-	for (size_t fold = 0; fold < batchSize; ++fold) {
-		// for each fold get one sample to form a batch
-		chosenIdx = randomFromInterval(0, randomFoldLength);
-		// get chosenIdx from the current fold from the shuffledIndexes
-		allocatedSubset[fold] = shuffledIndexes[fold * randomFoldLength + chosenIdx];
-	}
-}
-
-
 void GradientBoosting::nextFeatureSubset(const size_t featureSubsetSize,
 	const size_t featureCount,
 	std::vector<size_t>& allocatedFeatureSubset) const {
@@ -417,13 +562,6 @@ void GradientBoosting::nextFeatureSubset(const size_t featureSubsetSize,
 }
 
 
-size_t GradientBoosting::randomFromInterval(const size_t left,
-		const size_t right) {
-	// get random number in [left; right)
-	return (right - left) * size_t(rand() / (size_t(RAND_MAX) + 1)) + left;
-}
-
-
 std::vector<size_t> GradientBoosting::getOrderedIndexes(const size_t length) {
 	// for length N get std::vector<size_t> = {0, 1, 2, ..., N - 1}
 	std::vector<size_t> indexes(length, 0); // init vector
@@ -435,14 +573,9 @@ std::vector<size_t> GradientBoosting::getOrderedIndexes(const size_t length) {
 }
 
 
-void GradientBoosting::initForRandomBatches(const int randomSeed) {
-	randGenerator = std::default_random_engine(randomSeed);
-	// init array for the indexes that we will shuffle
-	shuffledIndexes = getOrderedIndexes(trainLen);
-	// all indexes will be splitted into M folds
-	// M == batchSize
-	// so we will take randomly one index from each fold
-	randomFoldLength = size_t(trainLen / batchSize);
+void GradientBoosting::validateFitted() const {
+	if (treeHolder == nullptr || predictor == nullptr)
+		throw std::runtime_error("The model was not fitted");
 }
 
 
@@ -474,3 +607,44 @@ bool GradientBoosting::valCptContents(const std::vector<size_t>& dPos,
 	// all checks passed
 	return true;
 }
+
+
+// the sample types
+template History GradientBoosting::fit<double>(
+	const MatrixView<const double>& xTrain, const LVector& yTrain,
+	const MatrixView<const double>& xValid, const LVector& yValid,
+	const size_t treeCount, const size_t treeDepth,
+	const float featureSubsetPart, const float learningRate,
+	const Lab_t regularizationParam, const Lab_t earlyStoppingDelta,
+	const float batchPart, const unsigned int randomState,
+	const bool randomBatches, const bool randomThresholds,
+	const bool removeRegularizationLater, const bool spoilScores,
+	const bool bootstrap);
+template History GradientBoosting::fit<float>(
+	const MatrixView<const float>& xTrain, const LVector& yTrain,
+	const MatrixView<const float>& xValid, const LVector& yValid,
+	const size_t treeCount, const size_t treeDepth,
+	const float featureSubsetPart, const float learningRate,
+	const Lab_t regularizationParam, const Lab_t earlyStoppingDelta,
+	const float batchPart, const unsigned int randomState,
+	const bool randomBatches, const bool randomThresholds,
+	const bool removeRegularizationLater, const bool spoilScores,
+	const bool bootstrap);
+template Lab_t GradientBoosting::predict<double>(
+	const VectorView<const double>& xTest) const;
+template Lab_t GradientBoosting::predict<float>(
+	const VectorView<const float>& xTest) const;
+template Labels GradientBoosting::predict<double>(
+	const MatrixView<const double>& xTest) const;
+template Labels GradientBoosting::predict<float>(
+	const MatrixView<const float>& xTest) const;
+template void GradientBoosting::predict<double>(
+	const MatrixView<const double>& xTest, Lab_t* answers) const;
+template void GradientBoosting::predict<float>(
+	const MatrixView<const float>& xTest, Lab_t* answers) const;
+template Lab_t GradientBoosting::predictFromTo<double>(
+	const VectorView<const double>& xTest, const size_t firstEstimator,
+	const size_t lastEstimator) const;
+template Lab_t GradientBoosting::predictFromTo<float>(
+	const VectorView<const float>& xTest, const size_t firstEstimator,
+	const size_t lastEstimator) const;
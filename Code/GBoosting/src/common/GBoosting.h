@@ -1,17 +1,18 @@
 #ifndef GBOOSTING_H
 #define GBOOSTING_H
 
-#include "PybindHeader.h"
 #include "Structs.h"
 #include "GBHist.h"
+#include "FeatureBins.h"
 #include "GBDecisionTree.h"
 #include "History.h"
 #include "TreeHolder.h"
 #include "GBPredictor.h"
+#include "ThreadPool.h"
 #include <vector>
-#include <random>
 #include <string>
 #include <memory>
+#include <shared_mutex>
 
 
 class GradientBoosting {
@@ -20,14 +21,20 @@ public:
 					 const size_t binCountMax,
 					 const size_t patience,
 					 const bool dontUseEarlyStopping,
-					 const size_t threadCnt);
+					 const size_t threadCnt,
+					 const bool quantileBins = false);
 	virtual ~GradientBoosting();
 	// 1st dim - object number, 2nd dim - feature number
 	// fit return the number of estimators (include constant estim)
-	History fit(const pytensor2& xTrain, 
-				const pytensorY& yTrain,
-				const pytensor2& xValid,
-				const pytensorY& yValid,
+	// In_t is the type of the samples: FVal_t or float
+	// (float halves the memory traffic of the train data)
+	// bootstrap: the random batches are drawn with replacement
+	// (see BatchSampler), randomBatches takes the folds in order instead
+	template <class In_t>
+	History fit(const MatrixView<const In_t>& xTrain, 
+				const LVector& yTrain,
+				const MatrixView<const In_t>& xValid,
+				const LVector& yValid,
 				const size_t treeCount,
 				const size_t treeDepth,
 				const float featureSubsetPart,
@@ -39,43 +46,57 @@ public:
 				const bool randomBatches,
 				const bool randomThresholds,
 				const bool removeRegularizationLater,
-				const bool spoilScores);
-	Lab_t predict(const pytensor1& xTest) const;
-	pytensorY predict(const pytensor2& xTest) const;
+				const bool spoilScores,
+				const bool bootstrap);
+	// In_t is the type of the samples: FVal_t or float
+	template <class In_t>
+	Lab_t predict(const VectorView<const In_t>& xTest) const;
+	template <class In_t>
+	Labels predict(const MatrixView<const In_t>& xTest) const;
+	// answers must have xTest.shape(0) items
+	template <class In_t>
+	void predict(const MatrixView<const In_t>& xTest, Lab_t* answers) const;
 
 	// predict "from-to" - predict using only subset of trees
 	// first estimator - the first tree number to predict (enumeration starts from 1)
 	// if first estimator == 0, include zero predictor (constant)
 	// last estimator - the last tree number to predict (enumeration starts from 1)
-	Lab_t predictFromTo(const pytensor1& xTest, 
+	template <class In_t>
+	Lab_t predictFromTo(const VectorView<const In_t>& xTest, 
 						const size_t firstEstimator, 
 						const size_t lastEstimator) const;
 
-	void saveModel(const std::string& fname) const;
+	// binary models are mapped on load and used without parsing
+	void saveModel(const std::string& fname, const bool binary = false) const;
+
+	// tile sizes for the batch prediction (0 to choose automatically)
+	void setPredictBlocks(const size_t rowBlock, const size_t treeBlock);
+	// compile the trees to the native code for predict (see JitEnsemble),
+	// the compiled model is cached in cacheDir ("" for the default one)
+	void compileJit(const std::string& cacheDir = "");
 	GradientBoosting(const std::string& fname,
 		const size_t threadCnt);
 
 protected:
-	static Lab_t loss(const pytensorY& pred, 
-					  const pytensorY& truth);
+	static Lab_t loss(const Labels& pred, 
+					  const LVector& truth);
 	inline bool canStop(const size_t stepNum, 
 						const Lab_t earlyStoppingDelta) const;
  
-	static inline size_t randomFromInterval(const size_t left,
-		const size_t right);
-
 	static inline std::vector<size_t> getOrderedIndexes(const size_t length);
 
 	inline void nextBatch(std::vector<size_t>& allocatedSubset) const;
 
-	inline void nextBatchRandom(std::vector<size_t>& allocatedSubset);
-
 	inline void nextFeatureSubset(const size_t featureSubsetSize,
 		const size_t featureCount,
 		std::vector<size_t>& allocatedFeatureSubset) const;
 
-	inline void initForRandomBatches(const int randomSeed);
+	inline void validateFitted() const;
 	
+	void saveBinary(const std::string& fname) const;
+	static bool isBinaryModel(const std::string& fname);
+	void loadBinary(const std::string& fname);
+
 	inline bool valCptContents(const std::vector<size_t>& dPos,
 		const char modelEnd, char const * const contents,
 		const size_t treeCnt, const size_t treeDepth,
@@ -88,22 +109,28 @@ protected:
 	size_t binCountMin;
 	size_t binCountMax;
 	size_t patience;
-	size_t randomFoldLength; // it's needed to form random batches
 	const size_t threadCnt;
-	std::vector<size_t> shuffledIndexes; // it's needed to form random batches
-	std::default_random_engine randGenerator;
+	std::shared_ptr<ThreadPool> threadPool; // workers for fit & predict
 	size_t batchSize;
 	Lab_t zeroPredictor; // constant model
 	std::vector<GBHist> hists; // histogram for each feature
-	pytensorY trainLosses;
-	pytensorY validLosses;
+	FeatureBins featureBins; // bin indexes of the train data
+	Labels trainLosses;
+	Labels validLosses;
 	bool dontUseEarlyStopping; // switch off early stopping
+	bool quantileBins; // bins by the quantiles of the features (not uniform)
+	size_t predictRowBlock = 0; // samples in a prediction tile (0 for auto)
+	size_t predictTreeBlock = 0; // trees in a prediction tile (0 for auto)
 	std::shared_ptr<TreeHolder> treeHolder = nullptr;
 	std::shared_ptr<GBPredictor> predictor = nullptr;
+	// predict & save may run from several threads at once,
+	// fit & setPredictBlocks wait for them (and vice versa)
+	mutable std::shared_mutex modelMutex;
 
 	// constants
 	static constexpr float whenRemoveRegularization = 0.8f; // the part of iterations with regularization	
 	static constexpr size_t modelType = 1; // regression (0 for classification)
+	static constexpr size_t sketchSizeMult = 8; // quantile sketch entries per max bin
 };
 
 #endif // GBOOSTING_H
@@ -3,13 +3,13 @@
 History::History() {}
 
 History::History(const size_t treeNumber,
-	const pytensorY& trainLosses,
-	const pytensorY& validLosses) : treesLearnt(treeNumber),
+	const Labels& trainLosses,
+	const Labels& validLosses) : treesLearnt(treeNumber),
 	trainLosses(trainLosses), validLosses(validLosses) {}
 
 
-void History::addAllLosses(const pytensorY& train,
-	const pytensorY& valid) {
+void History::addAllLosses(const Labels& train,
+	const Labels& valid) {
 	trainLosses = train;
 	validLosses = valid;
 }
@@ -22,10 +22,10 @@ size_t History::getTreesLearnt() const {
 	return treesLearnt;
 }
 
-pytensorY History::getTrainLosses() const {
+Labels History::getTrainLosses() const {
 	return trainLosses;
 }
 
-pytensorY History::getValidLosses() const {
+Labels History::getValidLosses() const {
 	return validLosses;
 }
\ No newline at end of file
@@ -2,7 +2,6 @@
 #define HISTORY_H
 
 #include <vector>
-#include "PybindHeader.h"
 #include "Structs.h"
 
 
@@ -10,23 +9,23 @@ class History {
 public:
 	History();
 	History(const size_t treeNumber,
-		const pytensorY& trainLosses,
-		const pytensorY& validLosses);
+		const Labels& trainLosses,
+		const Labels& validLosses);
 
 	// setters
-	void addAllLosses(const pytensorY& train,
-		const pytensorY& valid);
+	void addAllLosses(const Labels& train,
+		const Labels& valid);
 	void setTreesLearnt(const size_t learnt);
 
 	// getters
 	size_t getTreesLearnt() const;
-	pytensorY getTrainLosses() const;
-	pytensorY getValidLosses() const;
+	Labels getTrainLosses() const;
+	Labels getValidLosses() const;
 
 private:
 	size_t treesLearnt = 0;
-	pytensorY trainLosses;
-	pytensorY validLosses;
+	Labels trainLosses;
+	Labels validLosses;
 };
 
 #endif // HISTORY_H
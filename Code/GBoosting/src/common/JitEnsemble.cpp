@@ -0,0 +1,590 @@
+#include "JitEnsemble.h"
+#include "ModelWriter.h"
+
+// OS-dependent imports
+#ifdef _WIN32
+    // windows
+    #include <windows.h>
+    #include <io.h>
+    #include <process.h>
+#else
+    // linux & other POSIX systems
+    #include <dlfcn.h>
+    #include <cerrno>
+    #include <sys/stat.h>
+    #include <sys/types.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
+
+// the CPU identity (the code is compiled with -march=native)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define REGBM_JIT_CPUID
+    #include <cpuid.h>
+#endif
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+
+namespace {
+
+// exact C++ literal of the number
+std::string literal(const double val) {
+    if (std::isnan(val))
+        return "std::numeric_limits<double>::quiet_NaN()";
+    if (std::isinf(val))
+        return (val < 0)? "-std::numeric_limits<double>::infinity()" :
+            "std::numeric_limits<double>::infinity()";
+    // hexadecimal floats are parsed back without rounding
+    char buf[64];
+    const bool negative = std::signbit(val);
+    const auto res = std::to_chars(buf, buf + sizeof(buf), std::fabs(val),
+        std::chars_format::hex);
+    return std::string(negative? "-0x" : "0x") + std::string(buf, res.ptr);
+}
+
+
+std::string hexHash(const uint64_t hash) {
+    char buf[2 * sizeof(uint64_t)];
+    const char* digits = "0123456789abcdef";
+    for (size_t i = 0; i < sizeof(buf); ++i)
+        buf[i] = digits[(hash >> (4 * (sizeof(buf) - 1 - i))) & 0xF];
+    return std::string(buf, sizeof(buf));
+}
+
+
+// the CPU the native code is compiled for: the vendor, the model
+// & all the feature words of cpuid (the cores of a CPU may differ only
+// by the APIC id, it's skipped), /proc/cpuinfo on the other CPUs
+std::string cpuTarget() {
+    std::ostringstream target;
+#ifdef REGBM_JIT_CPUID
+    const auto word = [&target](const unsigned int val) {
+        target << std::hex << val << ' ';
+    };
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    // vendor, signature (family, model, stepping) & the features
+    if (__get_cpuid(0, &eax, &ebx, &ecx, &edx)) {
+        word(eax); word(ebx); word(ecx); word(edx);
+    }
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        word(eax); word(ecx); word(edx);
+    }
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        word(ebx); word(ecx); word(edx);
+    }
+    if (__get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx)) {
+        word(eax); word(edx);
+    }
+    if (__get_cpuid_count(0xD, 1, &eax, &ebx, &ecx, &edx))
+        word(eax);
+    if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx)) {
+        word(ecx); word(edx);
+    }
+    // model string
+    for (unsigned int leaf = 0x80000002; leaf <= 0x80000004; ++leaf) {
+        if (__get_cpuid(leaf, &eax, &ebx, &ecx, &edx)) {
+            word(eax); word(ebx); word(ecx); word(edx);
+        }
+    }
+    // the registers enabled by the OS (AVX, AVX-512)
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_OSXSAVE) != 0) {
+        unsigned int xcrLow = 0, xcrHigh = 0;
+        __asm__("xgetbv" : "=a"(xcrLow), "=d"(xcrHigh) : "c"(0));
+        word(xcrLow); word(xcrHigh);
+    }
+#else
+    // the first processor, without the changing fields (frequency...)
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line) && !line.empty()) {
+        const std::string key = line.substr(0, line.find(':'));
+        for (const char* stable : {"vendor_id", "cpu family", "model",
+            "model name", "stepping", "flags", "Features", "CPU implementer",
+            "CPU architecture", "CPU variant", "CPU part", "CPU revision"}) {
+            if (key.compare(0, key.find_last_not_of(" \t") + 1, stable) == 0)
+                target << line << '\n';
+        }
+    }
+#endif
+    return target.str();
+}
+
+
+// the command is split by the spaces only (there is no shell,
+// quotes and $(...) are passed to the program as they are)
+std::vector<std::string> splitCommand(const std::string& command) {
+    std::vector<std::string> args;
+    std::istringstream in(command);
+    std::string arg;
+    while (in >> arg)
+        args.push_back(arg);
+    return args;
+}
+
+
+// run the program (args[0] is searched in PATH) without a shell,
+// its stdout is written to output if it isn't null;
+// returns the exit code (-1 if the program can't be run)
+int runProgram(const std::vector<std::string>& args, std::string* output) {
+    if (args.empty())
+        return -1;
+#ifdef _WIN32
+    // the CRT joins the arguments by spaces
+    std::vector<std::string> quoted;
+    for (const auto& arg : args)
+        quoted.push_back("\"" + arg + "\"");
+    std::vector<const char*> argv;
+    for (const auto& arg : quoted)
+        argv.push_back(arg.c_str());
+    argv.push_back(nullptr);
+    // the child inherits stdout, so it's redirected for a while
+    FILE* outFile = nullptr;
+    int savedOut = -1;
+    if (output != nullptr) {
+        outFile = std::tmpfile();
+        if (outFile == nullptr)
+            return -1;
+        std::fflush(stdout);
+        savedOut = _dup(1);
+        _dup2(_fileno(outFile), 1);
+    }
+    const intptr_t status = _spawnvp(_P_WAIT, args[0].c_str(), argv.data());
+    if (output != nullptr) {
+        std::fflush(stdout);
+        _dup2(savedOut, 1);
+        _close(savedOut);
+        std::rewind(outFile);
+        char buf[256];
+        size_t len;
+        while ((len = std::fread(buf, 1, sizeof(buf), outFile)) > 0)
+            output->append(buf, len);
+        std::fclose(outFile);
+    }
+    return int(status);
+#else
+    // everything is prepared before fork (the child only calls exec)
+    std::vector<char*> argv;
+    for (const auto& arg : args)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    int pipeFds[2] = {-1, -1};
+    if (output != nullptr && pipe(pipeFds) != 0)
+        return -1;
+    const pid_t pid = fork();
+    if (pid < 0) {
+        if (output != nullptr) {
+            ::close(pipeFds[0]);
+            ::close(pipeFds[1]);
+        }
+        return -1;
+    }
+    if (pid == 0) {
+        if (output != nullptr) {
+            dup2(pipeFds[1], STDOUT_FILENO);
+            ::close(pipeFds[0]);
+            ::close(pipeFds[1]);
+        }
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    if (output != nullptr) {
+        ::close(pipeFds[1]);
+        char buf[256];
+        ssize_t len;
+        while ((len = read(pipeFds[0], buf, sizeof(buf))) != 0) {
+            if (len > 0)
+                output->append(buf, size_t(len));
+            else if (errno != EINTR)
+                break;
+        }
+        ::close(pipeFds[0]);
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return WIFEXITED(status)? WEXITSTATUS(status) : -1;
+#endif
+}
+
+
+// the cache is trusted only if nobody else can write to it
+bool isPrivate(const std::string& path) {
+#ifdef _WIN32
+    (void)path; // the default directory is in the user profile
+    return true;
+#else
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && info.st_uid == geteuid() &&
+        (info.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+#endif
+}
+
+
+// the directory is created for the user only
+void createPrivateDir(const std::string& dir) {
+    const std::filesystem::path path(dir);
+    std::error_code err;
+    if (path.has_parent_path())
+        std::filesystem::create_directories(path.parent_path(), err);
+#ifdef _WIN32
+    std::filesystem::create_directory(path, err);
+    const bool created = !err;
+#else
+    const bool created = mkdir(dir.c_str(), S_IRWXU) == 0 || errno == EEXIST;
+#endif
+    if (!created || !std::filesystem::is_directory(path, err))
+        throw std::runtime_error("JIT error: can't create the cache directory");
+    if (!isPrivate(dir))
+        throw std::runtime_error("JIT error: the cache directory must be "
+            "owned by the user and not writable by others");
+}
+
+} // namespace
+
+
+JitEnsemble::JitEnsemble(const PredictKernels::Forest& forest,
+    const size_t treeCnt, const size_t featureCnt,
+    const std::string& cacheDir): fromCache(false), library(nullptr),
+    row64(nullptr), row32(nullptr), batch64(nullptr), batch32(nullptr) {
+    // the key is known without running the compiler: a library
+    // from the cache is loaded even if there is no compiler
+    const std::vector<std::string> compiler = getCompiler();
+    const uint64_t hash = modelHash(forest, treeCnt, featureCnt, compiler);
+    const std::string dir = getCacheDir(cacheDir);
+    createPrivateDir(dir);
+#ifdef _WIN32
+    const char* extension = ".dll";
+#else
+    const char* extension = ".so";
+#endif
+    libraryPath = (std::filesystem::path(dir) /
+        ("regbm_jit_" + hexHash(hash) + extension)).string();
+
+    // the code of the library is run, so others' files aren't loaded
+    std::error_code err;
+    if (std::filesystem::exists(libraryPath, err) && isPrivate(libraryPath)) {
+        try {
+            load(hash);
+            fromCache = true;
+            return;
+        } catch (const std::runtime_error&) {
+            // broken file in the cache, compile it again
+            close();
+        }
+    }
+    compile(generateSource(forest, treeCnt, hash, getCompilerId(compiler)),
+        compiler, libraryPath);
+    try {
+        load(hash);
+    } catch (const std::runtime_error&) {
+        close(); // the dtor isn't called
+        throw;
+    }
+}
+
+
+JitEnsemble::~JitEnsemble() {
+    close();
+}
+
+
+Lab_t JitEnsemble::predictRow(const double* x,
+    const ptrdiff_t colStride) const {
+    return row64(x, colStride);
+}
+
+
+Lab_t JitEnsemble::predictRow(const float* x,
+    const ptrdiff_t colStride) const {
+    return row32(x, colStride);
+}
+
+
+void JitEnsemble::addBatch(const double* x, const ptrdiff_t rowStride,
+    const ptrdiff_t colStride, const size_t rowFrom, const size_t rowTo,
+    Lab_t* out) const {
+    batch64(x, rowStride, colStride, rowFrom, rowTo, out);
+}
+
+
+void JitEnsemble::addBatch(const float* x, const ptrdiff_t rowStride,
+    const ptrdiff_t colStride, const size_t rowFrom, const size_t rowTo,
+    Lab_t* out) const {
+    batch32(x, rowStride, colStride, rowFrom, rowTo, out);
+}
+
+
+const std::string& JitEnsemble::getLibraryPath() const {
+    return libraryPath;
+}
+
+
+bool JitEnsemble::isFromCache() const {
+    return fromCache;
+}
+
+
+const std::string& JitEnsemble::getCompilerId() const {
+    return compilerId;
+}
+
+
+std::string JitEnsemble::generateSource(const PredictKernels::Forest& forest,
+    const size_t treeCnt, const uint64_t hash, const std::string& compilerId) {
+    const size_t depth = forest.treeDepth;
+    const size_t innerNodes = (size_t(1) << depth) - 1;
+    const size_t leafCnt = size_t(1) << depth;
+    const size_t functionCnt = (treeCnt + treesPerFunction - 1) / treesPerFunction;
+    std::ostringstream src;
+    src << "// generated by regbm, don't edit\n"
+        "#include <cstddef>\n#include <cstdint>\n#include <limits>\n\n"
+        "#ifdef _WIN32\n#define REGBM_EXPORT __declspec(dllexport)\n"
+        "#else\n#define REGBM_EXPORT\n#endif\n\n"
+        "namespace {\n\n";
+    // thresholds & leaves of each tree
+    for (size_t i = 0; i < treeCnt; ++i) {
+        src << "const double t" << i << "[] = {";
+        for (size_t j = 0; j < innerNodes; ++j)
+            src << literal(forest.thresholds[i * innerNodes + j]) << ",";
+        src << "};\nconst double l" << i << "[] = {";
+        for (size_t j = 0; j < leafCnt; ++j)
+            src << literal(forest.leaves[i * leafCnt + j]) << ",";
+        src << "};\n";
+    }
+    // trees of a block: acc + tree[from] + ... + tree[to - 1];
+    // the same branchless walk as TreeHolder::findLeaf
+    // with the features written as constants
+    for (size_t k = 0; k < functionCnt; ++k) {
+        src << "\ntemplate <class T>\ninline double trees" << k <<
+            "(const T* x, const std::ptrdiff_t cs, double acc) {\n"
+            "    std::size_t n;\n";
+        const size_t treeTo = std::min(treeCnt, (k + 1) * treesPerFunction);
+        for (size_t i = k * treesPerFunction; i < treeTo; ++i) {
+            src << "    n = 0;\n";
+            for (size_t h = 0; h < depth; ++h)
+                src << "    n = 2 * n + 2 - std::size_t(double(x[" <<
+                    forest.features[i * depth + h] << " * cs]) < t" << i <<
+                    "[n]);\n";
+            src << "    acc += l" << i << "[n - " << innerNodes << "];\n";
+        }
+        src << "    return acc;\n}\n";
+    }
+    // single row
+    src << "\ntemplate <class T>\n"
+        "inline double predictRow(const T* x, const std::ptrdiff_t cs) {\n"
+        "    double acc = 0;\n";
+    for (size_t k = 0; k < functionCnt; ++k)
+        src << "    acc = trees" << k << "(x, cs, acc);\n";
+    src << "    return acc;\n}\n";
+    // batch: tiles of rows x blocks of trees, so the rows stay in cache
+    src << "\ntemplate <class T>\n"
+        "inline void addBatch(const T* x, const std::ptrdiff_t rs,\n"
+        "    const std::ptrdiff_t cs, const std::size_t from,\n"
+        "    const std::size_t to, double* out) {\n"
+        "    for (std::size_t begin = from; begin < to; begin += " <<
+        rowBlock << ") {\n"
+        "        const std::size_t end = (to - begin < " << rowBlock <<
+        ")? to : begin + " << rowBlock << ";\n";
+    for (size_t k = 0; k < functionCnt; ++k)
+        src << "        for (std::size_t i = begin; i < end; ++i)\n"
+            "            out[i] = trees" << k <<
+            "(x + std::ptrdiff_t(i) * rs, cs, out[i]);\n";
+    src << "    }\n}\n\n";
+    // the compiler (any bytes, so the chars are numbers)
+    src << "const unsigned char compilerId[] = {";
+    for (const char c : compilerId)
+        src << int((unsigned char)c) << ",";
+    src << "0};\n\n} // namespace\n\n";
+    // entry points
+    src << "extern \"C\" {\n"
+        "REGBM_EXPORT double regbm_row_f64(const double* x, std::ptrdiff_t cs) {\n"
+        "    return predictRow(x, cs);\n}\n"
+        "REGBM_EXPORT double regbm_row_f32(const float* x, std::ptrdiff_t cs) {\n"
+        "    return predictRow(x, cs);\n}\n"
+        "REGBM_EXPORT void regbm_batch_f64(const double* x, std::ptrdiff_t rs,\n"
+        "    std::ptrdiff_t cs, std::size_t from, std::size_t to, double* out) {\n"
+        "    addBatch(x, rs, cs, from, to, out);\n}\n"
+        "REGBM_EXPORT void regbm_batch_f32(const float* x, std::ptrdiff_t rs,\n"
+        "    std::ptrdiff_t cs, std::size_t from, std::size_t to, double* out) {\n"
+        "    addBatch(x, rs, cs, from, to, out);\n}\n"
+        "REGBM_EXPORT std::uint64_t regbm_hash() {\n"
+        "    return 0x" << hexHash(hash) << "ULL;\n}\n"
+        "REGBM_EXPORT const char* regbm_compiler() {\n"
+        "    return (const char*)compilerId;\n}\n"
+        "}\n";
+    return src.str();
+}
+
+
+uint64_t JitEnsemble::modelHash(const PredictKernels::Forest& forest,
+    const size_t treeCnt, const size_t featureCnt,
+    const std::vector<std::string>& compiler) {
+    const size_t depth = forest.treeDepth;
+    const size_t innerNodes = (size_t(1) << depth) - 1;
+    const size_t leafCnt = size_t(1) << depth;
+    // the code depends on the trees, the generator, the compiler
+    // command & the CPU (-march=native); the compiler version isn't
+    // a part of the key (the code of an older one is still right)
+    const uint64_t header[] = {generatorVersion, uint64_t(treeCnt),
+        uint64_t(featureCnt), uint64_t(depth)};
+    uint64_t hash = ModelWriter::checksum((const char*)header, sizeof(header));
+    std::string command;
+    for (const auto& arg : compiler)
+        command += arg + ' ';
+    hash = ModelWriter::checksum(command.data(), command.size(), hash);
+    const std::string target = cpuTarget();
+    hash = ModelWriter::checksum(target.data(), target.size(), hash);
+    hash = ModelWriter::checksum((const char*)forest.features,
+        treeCnt * depth * sizeof(FIdx_t), hash);
+    hash = ModelWriter::checksum((const char*)forest.thresholds,
+        treeCnt * innerNodes * sizeof(FVal_t), hash);
+    return ModelWriter::checksum((const char*)forest.leaves,
+        treeCnt * leafCnt * sizeof(Lab_t), hash);
+}
+
+
+std::string JitEnsemble::getCacheDir(const std::string& cacheDir) {
+    if (!cacheDir.empty())
+        return cacheDir;
+    const char* env = std::getenv("REGBM_JIT_CACHE");
+    if (env != nullptr && env[0] != '\0')
+        return env;
+    // the cache of the user (not the shared temporary directory)
+#ifdef _WIN32
+    const char* base = std::getenv("LOCALAPPDATA");
+    if (base != nullptr && base[0] != '\0')
+        return (std::filesystem::path(base) / "regbm_jit").string();
+#else
+    const char* xdg = std::getenv("XDG_CACHE_HOME");
+    if (xdg != nullptr && xdg[0] == '/')
+        return (std::filesystem::path(xdg) / "regbm_jit").string();
+    const char* home = std::getenv("HOME");
+    if (home != nullptr && home[0] == '/')
+        return (std::filesystem::path(home) / ".cache" / "regbm_jit").string();
+#endif
+    throw std::runtime_error("JIT error: can't find the cache directory "
+        "(set REGBM_JIT_CACHE)");
+}
+
+
+std::vector<std::string> JitEnsemble::getCompiler() {
+    const char* env = std::getenv("REGBM_JIT_CXX");
+    std::vector<std::string> compiler = splitCommand(
+        (env != nullptr)? env : "");
+    if (compiler.empty())
+        compiler.push_back("c++");
+    return compiler;
+}
+
+
+std::string JitEnsemble::getCompilerId(
+    const std::vector<std::string>& compiler) {
+    // an upgraded compiler has the same command, but other version
+    std::vector<std::string> args = compiler;
+    args.push_back("--version");
+    std::string version;
+    if (runProgram(args, &version) != 0)
+        throw std::runtime_error("JIT error: can't run the compiler");
+    std::string id;
+    for (const auto& arg : compiler)
+        id += arg + ' ';
+    return id + '\n' + version;
+}
+
+
+void JitEnsemble::compile(const std::string& source,
+    const std::vector<std::string>& compiler, const std::string& libraryPath) {
+    // unique names: other processes may compile the same model
+    std::random_device rd;
+    const std::string tmpName = libraryPath + "." +
+        hexHash((uint64_t(rd()) << 32) | rd());
+    const std::string srcPath = tmpName + ".cpp";
+    const std::string tmpLibrary = tmpName + ".tmp";
+    {
+        std::ofstream out(srcPath);
+        out << source;
+        if (!out)
+            throw std::runtime_error("JIT error: can't write the source file");
+    }
+    std::vector<std::string> args = compiler;
+    for (const char* flag : {"-std=c++17", "-O3", "-march=native", "-shared",
+        "-fPIC", "-o"})
+        args.push_back(flag);
+    args.push_back(tmpLibrary);
+    args.push_back(srcPath);
+    const int status = runProgram(args, nullptr);
+    std::error_code err;
+    std::filesystem::remove(srcPath, err);
+    if (status != 0) {
+        std::filesystem::remove(tmpLibrary, err);
+        throw std::runtime_error("JIT error: can't compile the model");
+    }
+    // only the user can change the library (see isPrivate)
+    std::filesystem::permissions(tmpLibrary, std::filesystem::perms::owner_all,
+        std::filesystem::perm_options::replace, err);
+    // readers never see a half-written library
+    std::filesystem::rename(tmpLibrary, libraryPath, err);
+    if (err) {
+        std::filesystem::remove(tmpLibrary, err);
+        throw std::runtime_error("JIT error: can't write to the cache");
+    }
+}
+
+
+void JitEnsemble::load(const uint64_t hash) {
+#ifdef _WIN32
+    library = (void*)LoadLibraryA(libraryPath.c_str());
+#else
+    library = dlopen(libraryPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+    if (library == nullptr)
+        throw std::runtime_error("JIT error: can't open the library");
+    const Hash_t libraryHash = (Hash_t)getSymbol("regbm_hash");
+    const Compiler_t libraryCompiler = (Compiler_t)getSymbol("regbm_compiler");
+    row64 = (Row64_t)getSymbol("regbm_row_f64");
+    row32 = (Row32_t)getSymbol("regbm_row_f32");
+    batch64 = (Batch64_t)getSymbol("regbm_batch_f64");
+    batch32 = (Batch32_t)getSymbol("regbm_batch_f32");
+    if (libraryHash == nullptr || libraryCompiler == nullptr ||
+        row64 == nullptr || row32 == nullptr ||
+        batch64 == nullptr || batch32 == nullptr)
+        throw std::runtime_error("JIT error: can't find the entry points");
+    if (libraryHash() != hash)
+        throw std::runtime_error("JIT error: the library is for other model");
+    compilerId = libraryCompiler();
+}
+
+
+void* JitEnsemble::getSymbol(const char* name) const {
+#ifdef _WIN32
+    return (void*)GetProcAddress((HMODULE)library, name);
+#else
+    return dlsym(library, name);
+#endif
+}
+
+
+void JitEnsemble::close() {
+    if (library == nullptr)
+        return;
+#ifdef _WIN32
+    FreeLibrary((HMODULE)library);
+#else
+    dlclose(library);
+#endif
+    library = nullptr;
+}
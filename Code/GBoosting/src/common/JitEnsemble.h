@@ -0,0 +1,101 @@
+#ifndef JIT_ENSEMBLE_H_INCLUDED
+#define JIT_ENSEMBLE_H_INCLUDED
+
+#include "AtomicTypes.h"
+#include "PredictKernels.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// The whole ensemble compiled to the native code.
+// One C++ translation unit is generated for the model (features
+// and the levels of the trees are constants, the walks are unrolled),
+// it is compiled once by the external compiler (-O3 -march=native)
+// to a shared library, which is cached on disk: the file name
+// contains the hash of the model, of the compiler command and of the CPU
+// (its model and features), so the next runs (or other processes)
+// just load it without running the compiler.
+// Trees are added in the same order as in TreeHolder,
+// so the predictions are the same bit for bit.
+//
+// The cache directory is cacheDir or $REGBM_JIT_CACHE or the cache of
+// the user ($XDG_CACHE_HOME/regbm_jit, ~/.cache/regbm_jit); it must be
+// owned by the user and not writable by others (the libraries of other
+// users are never loaded). The compiler is $REGBM_JIT_CXX or c++,
+// it is run without a shell (the command is split by the spaces)
+class JitEnsemble {
+public:
+    JitEnsemble(const PredictKernels::Forest& forest, const size_t treeCnt,
+        const size_t featureCnt, const std::string& cacheDir = "");
+    virtual ~JitEnsemble();
+
+    JitEnsemble(const JitEnsemble&) = delete;
+    JitEnsemble& operator=(const JitEnsemble&) = delete;
+
+    // sum of all trees for x(f) = x[f * colStride]
+    Lab_t predictRow(const double* x, const ptrdiff_t colStride) const;
+    Lab_t predictRow(const float* x, const ptrdiff_t colStride) const;
+    // out[i] += sum of all trees for rows [rowFrom; rowTo),
+    // x(i, f) is x[i * rowStride + f * colStride]
+    void addBatch(const double* x, const ptrdiff_t rowStride,
+        const ptrdiff_t colStride, const size_t rowFrom, const size_t rowTo,
+        Lab_t* out) const;
+    void addBatch(const float* x, const ptrdiff_t rowStride,
+        const ptrdiff_t colStride, const size_t rowFrom, const size_t rowTo,
+        Lab_t* out) const;
+
+    const std::string& getLibraryPath() const;
+    bool isFromCache() const; // the library was compiled before
+    // the command & the version of the compiler which built the library
+    const std::string& getCompilerId() const;
+
+private:
+    // entry points of the generated library
+    using Row64_t = double (*)(const double*, ptrdiff_t);
+    using Row32_t = double (*)(const float*, ptrdiff_t);
+    using Batch64_t = void (*)(const double*, ptrdiff_t, ptrdiff_t,
+        size_t, size_t, double*);
+    using Batch32_t = void (*)(const float*, ptrdiff_t, ptrdiff_t,
+        size_t, size_t, double*);
+    using Hash_t = uint64_t (*)();
+    using Compiler_t = const char* (*)();
+
+    // fields
+    std::string libraryPath;
+    bool fromCache;
+    std::string compilerId;
+    void* library; // handle of the loaded library
+    Row64_t row64;
+    Row32_t row32;
+    Batch64_t batch64;
+    Batch32_t batch32;
+
+    // methods
+    static std::string generateSource(const PredictKernels::Forest& forest,
+        const size_t treeCnt, const uint64_t hash,
+        const std::string& compilerId);
+    static uint64_t modelHash(const PredictKernels::Forest& forest,
+        const size_t treeCnt, const size_t featureCnt,
+        const std::vector<std::string>& compiler);
+    static std::string getCacheDir(const std::string& cacheDir);
+    static std::vector<std::string> getCompiler(); // program & its args
+    // the command & the version of the compiler (runs it)
+    static std::string getCompilerId(const std::vector<std::string>& compiler);
+    // compile the source to the library (through temporary files,
+    // the library appears under its name atomically)
+    static void compile(const std::string& source,
+        const std::vector<std::string>& compiler,
+        const std::string& libraryPath);
+    void load(const uint64_t hash); // throws if the library is wrong
+    void* getSymbol(const char* name) const;
+    void close();
+
+    // constants
+    static constexpr size_t treesPerFunction = 64; // keeps the compile fast
+    static constexpr size_t rowBlock = 64; // rows of a batch tile
+    static constexpr uint64_t generatorVersion = 2; // change with the generator
+};
+
+#endif // JIT_ENSEMBLE_H_INCLUDED
@@ -0,0 +1,95 @@
+#include "MappedFile.h"
+
+// OS-dependent imports
+#ifndef _WIN32
+    // linux & other POSIX systems
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+// windows.h already included in MappedFile.h
+
+#include <stdexcept>
+
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& fname): start(nullptr),
+    fileSize(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL) {
+    fileHandle = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Can't open the file");
+    LARGE_INTEGER winSize;
+    if (!GetFileSizeEx(fileHandle, &winSize)) {
+        CloseHandle(fileHandle);
+        throw std::runtime_error("Error occurred while reading the file");
+    }
+    fileSize = size_t(winSize.QuadPart);
+    if (fileSize == 0)
+        return; // nothing to map
+    mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY,
+        0, 0, NULL);
+    if (mappingHandle != NULL)
+        start = (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ,
+            0, 0, 0);
+    if (start == nullptr) {
+        if (mappingHandle != NULL)
+            CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        throw std::runtime_error("Can't map the file to memory");
+    }
+}
+
+
+MappedFile::~MappedFile() {
+    if (start != nullptr)
+        UnmapViewOfFile(start);
+    if (mappingHandle != NULL)
+        CloseHandle(mappingHandle);
+    CloseHandle(fileHandle);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& fname): start(nullptr),
+    fileSize(0) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Can't open the file");
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        close(fd);
+        throw std::runtime_error("Error occurred while reading the file");
+    }
+    fileSize = size_t(fileStat.st_size);
+    if (fileSize != 0) {
+        void* mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Can't map the file to memory");
+        }
+        start = (const char*)mapped;
+    }
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+}
+
+
+MappedFile::~MappedFile() {
+    if (start != nullptr)
+        munmap((void*)start, fileSize);
+}
+
+#endif // _WIN32
+
+
+const char* MappedFile::data() const {
+    return start;
+}
+
+
+size_t MappedFile::size() const {
+    return fileSize;
+}
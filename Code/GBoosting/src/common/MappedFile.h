@@ -0,0 +1,39 @@
+#ifndef MAPPED_FILE_H_INCLUDED
+#define MAPPED_FILE_H_INCLUDED
+
+#include <cstddef>
+#include <string>
+
+// OS-dependent imports
+#ifdef _WIN32
+    // windows
+    // import windows.h for HANDLE type
+    #include <windows.h>
+#endif
+
+
+// Read-only memory mapping of the whole file.
+// The file is unmapped in the destructor
+class MappedFile {
+public:
+    MappedFile(const std::string& fname);
+    virtual ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const;
+    size_t size() const;
+private:
+    const char* start;
+    size_t fileSize;
+
+    // OS-dependent handles
+    #ifdef _WIN32
+        // windows
+        HANDLE fileHandle;
+        HANDLE mappingHandle;
+    #endif
+};
+
+#endif // MAPPED_FILE_H_INCLUDED
@@ -0,0 +1,89 @@
+#include "ModelWriter.h"
+#include <charconv>
+#include <stdexcept>
+
+
+ModelWriter::ModelWriter(const std::string& fname): buffer(bufferSize),
+    used(0), hash(checksumSeed) {
+    pFile = fopen(fname.c_str(), "wb");
+    if (pFile == nullptr)
+        throw std::runtime_error("Can't open the file");
+}
+
+
+ModelWriter::~ModelWriter() {
+    // close() was not called (an exception), don't throw from here
+    if (pFile != nullptr)
+        fclose(pFile);
+}
+
+
+void ModelWriter::write(const char sym) {
+    reserve(1);
+    buffer[used++] = sym;
+}
+
+
+void ModelWriter::writeSizeT(const size_t val) {
+    reserve(maxNumberLen);
+    char* start = buffer.data() + used;
+    std::to_chars_result res = std::to_chars(start, start + maxNumberLen, val);
+    used += res.ptr - start;
+}
+
+
+void ModelWriter::writeFloat(const double val) {
+    reserve(maxNumberLen);
+    char* start = buffer.data() + used;
+    std::to_chars_result res = std::to_chars(start, start + maxNumberLen, val);
+    used += res.ptr - start;
+}
+
+
+void ModelWriter::writeChecksum() {
+    flush();
+    const uint64_t curHash = hash;
+    reserve(checksumLen);
+    char* start = buffer.data() + used;
+    // leading zeros are written too
+    for (size_t i = 0; i < checksumLen; ++i) {
+        const size_t digit = (curHash >> (4 * (checksumLen - 1 - i))) & 0xF;
+        start[i] = "0123456789abcdef"[digit];
+    }
+    used += checksumLen;
+}
+
+
+void ModelWriter::close() {
+    flush();
+    const bool failed = (fclose(pFile) != 0);
+    pFile = nullptr;
+    if (failed)
+        throw std::runtime_error("Error occurred while writing the file");
+}
+
+
+uint64_t ModelWriter::checksum(const char* data, const size_t size,
+    uint64_t hash) {
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= checksumPrime;
+    }
+    return hash;
+}
+
+
+void ModelWriter::reserve(const size_t size) {
+    if (used + size > bufferSize)
+        flush();
+}
+
+
+void ModelWriter::flush() {
+    if (used == 0)
+        return;
+    hash = checksum(buffer.data(), used, hash);
+    if (fwrite(buffer.data(), sizeof(char), used, pFile) != used)
+        throw std::runtime_error("Error occurred while writing the file");
+    used = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef MODEL_WRITER_H_INCLUDED
+#define MODEL_WRITER_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+// Buffered writer of the text model file.
+// The contents go to the file in chunks of bufferSize bytes,
+// the checksum (64-bit FNV-1a) of all written bytes is updated on the way
+class ModelWriter {
+public:
+    ModelWriter(const std::string& fname);
+    virtual ~ModelWriter();
+
+    ModelWriter(const ModelWriter&) = delete;
+    ModelWriter& operator=(const ModelWriter&) = delete;
+
+    void write(const char sym);
+    void writeSizeT(const size_t val);
+    // the shortest text which is parsed back to the same value
+    void writeFloat(const double val);
+    // checksum of all bytes written before as checksumLen hex digits
+    void writeChecksum();
+    // flush the buffer and close the file, throws on write errors
+    void close();
+
+    // continue the checksum of the previous bytes with data[0; size)
+    static uint64_t checksum(const char* data, const size_t size,
+        uint64_t hash = checksumSeed);
+
+    // constants
+    static constexpr size_t checksumLen = 16;
+    static constexpr uint64_t checksumSeed = 14695981039346656037ULL;
+private:
+    FILE* pFile;
+    std::vector<char> buffer;
+    size_t used; // bytes in the buffer
+    uint64_t hash; // checksum of the flushed bytes
+
+    inline void reserve(const size_t size);
+    void flush();
+
+    // constants
+    static constexpr size_t bufferSize = 1 << 16;
+    static constexpr size_t maxNumberLen = 32; // enough for any number
+    static constexpr uint64_t checksumPrime = 1099511628211ULL;
+};
+
+#endif // MODEL_WRITER_H_INCLUDED
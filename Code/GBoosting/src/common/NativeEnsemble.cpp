@@ -0,0 +1,177 @@
+#include "NativeEnsemble.h"
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+#include <type_traits>
+
+// the code is emitted for the System V calling convention
+#if defined(__linux__) && defined(__x86_64__)
+    #define NATIVE_ENSEMBLE_X64
+    #include <sys/mman.h>
+#endif
+
+
+namespace {
+
+// x86-64 instructions of the tree walk, the registers are fixed:
+// rdi - row, rsi - thresholds, rdx - leaves, xmm0 - sum (the result),
+// rax - current node, rcx - comparison result, xmm1 - feature value,
+// xmm2 - threshold
+class Assembler {
+public:
+    std::vector<uint8_t> code;
+
+    void xorEaxEax() {
+        bytes({0x31, 0xC0});
+    }
+    void xorEcxEcx() {
+        bytes({0x31, 0xC9});
+    }
+    // movsd xmm1, [rdi + disp]
+    void loadFeature(const int32_t disp) {
+        bytes({0xF2, 0x0F, 0x10, 0x8F});
+        imm32(disp);
+    }
+    // movsd xmm2, [rsi + rax * 8 + disp]
+    void loadThreshold(const int32_t disp) {
+        bytes({0xF2, 0x0F, 0x10, 0x94, 0xC6});
+        imm32(disp);
+    }
+    // ucomisd xmm2, xmm1; seta cl (x < t, false for NaN)
+    void compare() {
+        bytes({0x66, 0x0F, 0x2E, 0xD1, 0x0F, 0x97, 0xC1});
+    }
+    // lea rax, [rax + rax + 2]; sub rax, rcx
+    void nextNode() {
+        bytes({0x48, 0x8D, 0x44, 0x00, 0x02, 0x48, 0x29, 0xC8});
+    }
+    // addsd xmm0, [rdx + rax * 8 + disp]
+    void addLeaf(const int32_t disp) {
+        bytes({0xF2, 0x0F, 0x58, 0x84, 0xC2});
+        imm32(disp);
+    }
+    void ret() {
+        bytes({0xC3});
+    }
+private:
+    void bytes(std::initializer_list<uint8_t> list) {
+        code.insert(code.end(), list);
+    }
+    void imm32(const int32_t val) {
+        uint8_t buf[sizeof(val)];
+        std::memcpy(buf, &val, sizeof(val)); // x86 is little-endian
+        code.insert(code.end(), buf, buf + sizeof(val));
+    }
+};
+
+
+// displacements of the instructions are 32-bit
+int32_t toDisp(const int64_t offset) {
+    if (offset < INT32_MIN || offset > INT32_MAX)
+        throw std::runtime_error("The model is too big for the native code");
+    return int32_t(offset);
+}
+
+} // namespace
+
+
+NativeEnsemble::NativeEnsemble(const PredictKernels::Forest& forest,
+    const size_t treeCnt, const size_t featureCnt):
+    thresholds(forest.thresholds), leaves(forest.leaves),
+    featureCnt(featureCnt), code(nullptr), codeSize(0), function(nullptr) {
+#ifdef NATIVE_ENSEMBLE_X64
+    const std::vector<uint8_t> bytes = emit(forest, treeCnt);
+    codeSize = bytes.size();
+    // write, then make executable (the memory is never both)
+    void* mem = mmap(nullptr, codeSize, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        throw std::runtime_error("Can't allocate memory for the native code");
+    std::memcpy(mem, bytes.data(), codeSize);
+    if (mprotect(mem, codeSize, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, codeSize);
+        throw std::runtime_error("Can't make the native code executable");
+    }
+    code = mem;
+    function = (Function_t)code;
+#else
+    (void)treeCnt;
+    throw std::runtime_error("The native code isn't supported on this system");
+#endif
+}
+
+
+NativeEnsemble::~NativeEnsemble() {
+#ifdef NATIVE_ENSEMBLE_X64
+    if (code != nullptr)
+        munmap(code, codeSize);
+#endif
+}
+
+
+template <class In_t>
+Lab_t NativeEnsemble::predictRow(const In_t* x,
+    const ptrdiff_t colStride) const {
+    if (featureCnt > stackFeatures) {
+        std::vector<double> buffer(featureCnt);
+        return function(contiguousRow(x, colStride, buffer.data()),
+            thresholds, leaves, 0);
+    }
+    double buffer[stackFeatures];
+    return function(contiguousRow(x, colStride, buffer),
+        thresholds, leaves, 0);
+}
+
+
+bool NativeEnsemble::isSupported() {
+#ifdef NATIVE_ENSEMBLE_X64
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+std::vector<uint8_t> NativeEnsemble::emit(
+    const PredictKernels::Forest& forest, const size_t treeCnt) {
+    const size_t depth = forest.treeDepth;
+    const int64_t innerNodes = (int64_t(1) << depth) - 1;
+    const int64_t leafCnt = int64_t(1) << depth;
+    const int64_t valSize = sizeof(double);
+    Assembler as;
+    // xmm0 (acc) is added the leaves of the trees in order;
+    // each level: node = 2 * node + 2 - (x[f] < thresholds[node])
+    for (size_t i = 0; i < treeCnt; ++i) {
+        as.xorEaxEax();
+        const int32_t thresholdsDisp = toDisp(int64_t(i) * innerNodes * valSize);
+        for (size_t h = 0; h < depth; ++h) {
+            as.loadFeature(toDisp(int64_t(forest.features[i * depth + h]) * valSize));
+            as.loadThreshold(thresholdsDisp);
+            as.xorEcxEcx();
+            as.compare();
+            as.nextNode();
+        }
+        // leaves of the tree start from the node innerNodes
+        as.addLeaf(toDisp((int64_t(i) * leafCnt - innerNodes) * valSize));
+    }
+    as.ret();
+    return as.code;
+}
+
+
+template <class In_t>
+const double* NativeEnsemble::contiguousRow(const In_t* x,
+    const ptrdiff_t colStride, double* buffer) const {
+    if (std::is_same<In_t, double>::value && colStride == 1)
+        return (const double*)x;
+    for (size_t f = 0; f < featureCnt; ++f)
+        buffer[f] = double(x[ptrdiff_t(f) * colStride]);
+    return buffer;
+}
+
+
+// the sample types
+template Lab_t NativeEnsemble::predictRow<double>(const double* x,
+    const ptrdiff_t colStride) const;
+template Lab_t NativeEnsemble::predictRow<float>(const float* x,
+    const ptrdiff_t colStride) const;
@@ -0,0 +1,60 @@
+#ifndef NATIVE_ENSEMBLE_H_INCLUDED
+#define NATIVE_ENSEMBLE_H_INCLUDED
+
+#include "AtomicTypes.h"
+#include "PredictKernels.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+// The whole ensemble as x86-64 machine code, written right to
+// the executable memory (no compiler is needed, it takes milliseconds).
+// The code walks the trees one by one like TreeHolder::findLeaf:
+// the features are the offsets in the instructions, the thresholds
+// and the leaves are read from the packed trees (they must outlive
+// the object), so the predictions are the same bit for bit.
+// It's used for the single samples: the vector kernels of TreeHolder
+// are faster for the batches.
+// Only x86-64 Linux is supported, the ctor throws on other systems
+// or if the memory can't be made executable
+class NativeEnsemble {
+public:
+    NativeEnsemble(const PredictKernels::Forest& forest, const size_t treeCnt,
+        const size_t featureCnt);
+    virtual ~NativeEnsemble();
+
+    NativeEnsemble(const NativeEnsemble&) = delete;
+    NativeEnsemble& operator=(const NativeEnsemble&) = delete;
+
+    // In_t is the type of the samples: FVal_t or float
+    // sum of all trees for x(f) = x[f * colStride]
+    template <class In_t>
+    Lab_t predictRow(const In_t* x, const ptrdiff_t colStride) const;
+
+    static bool isSupported(); // the code can be emitted on this system
+private:
+    // the emitted function: acc + sum of all trees for the contiguous row
+    using Function_t = double (*)(const double* x, const FVal_t* thresholds,
+        const Lab_t* leaves, double acc);
+
+    static constexpr size_t stackFeatures = 256; // wider rows use the heap
+
+    // fields
+    const FVal_t* thresholds;
+    const Lab_t* leaves;
+    size_t featureCnt;
+    void* code; // executable memory
+    size_t codeSize;
+    Function_t function;
+
+    // methods
+    static std::vector<uint8_t> emit(const PredictKernels::Forest& forest,
+        const size_t treeCnt);
+    // the emitted code reads double rows without strides
+    template <class In_t>
+    inline const double* contiguousRow(const In_t* x,
+        const ptrdiff_t colStride, double* buffer) const;
+};
+
+#endif // NATIVE_ENSEMBLE_H_INCLUDED
@@ -1,12 +1,23 @@
 #include "ParseHelper.h"
-#include <cstdlib>
+#include <charconv>
+#include <stdexcept>
+#include <system_error>
 
 
-size_t ParseHelper::parseSizeT(const char* start) {
-    return std::strtol(start, nullptr, base);
+size_t ParseHelper::parseSizeT(const char* start, const char* end) {
+    size_t ans = 0;
+    std::from_chars_result res = std::from_chars(start, end, ans, base);
+    if (res.ec != std::errc())
+        throw std::runtime_error("Can't load model: invalid file");
+    return ans;
 }
 
 
-double ParseHelper::parseFloat(const char* start) {
-    return std::strtod(start, nullptr);
+double ParseHelper::parseFloat(const char* start, const char* end) {
+    double ans = 0;
+    std::from_chars_result res = std::from_chars(start, end, ans);
+    if (res.ec != std::errc())
+        throw std::runtime_error("Can't load model: invalid file");
+    return ans;
 }
+
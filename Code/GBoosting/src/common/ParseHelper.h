@@ -6,8 +6,9 @@
 
 class ParseHelper {
 public:
-    static size_t parseSizeT(const char* start);
-    static double parseFloat(const char* start);
+    // parse the number starting at start, the text must end before end
+    static size_t parseSizeT(const char* start, const char* end);
+    static double parseFloat(const char* start, const char* end);
 private:
     // only static members
     ParseHelper() = delete;
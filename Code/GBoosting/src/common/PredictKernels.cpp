@@ -0,0 +1,282 @@
+#include "PredictKernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define REGBM_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+// the levels of the trees are unrolled if the depth is known
+#ifdef __GNUC__
+#define REGBM_UNROLL_LEVELS _Pragma("GCC unroll 16")
+#else
+#define REGBM_UNROLL_LEVELS
+#endif
+
+
+PredictKernels::Isa PredictKernels::detectIsa() {
+#ifdef REGBM_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return Isa::Avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return Isa::Avx2;
+#endif
+    return Isa::Scalar;
+}
+
+
+template <class In_t>
+PredictKernels::AddTrees_t<In_t> PredictKernels::getKernel(const Isa isa,
+    const size_t treeDepth) {
+    return selectKernel<In_t>(isa, treeDepth,
+        std::make_index_sequence<maxUnrolledDepth + 1>());
+}
+
+
+template <class In_t, size_t... Depths>
+PredictKernels::AddTrees_t<In_t> PredictKernels::selectKernel(const Isa isa,
+    const size_t treeDepth, std::index_sequence<Depths...>) {
+    static const AddTrees_t<In_t> scalar[] = {&addTreesScalar<In_t, Depths>...};
+    static const AddTrees_t<In_t> avx2[] = {&addTreesAvx2<In_t, Depths>...};
+    static const AddTrees_t<In_t> avx512[] = {&addTreesAvx512<In_t, Depths>...};
+    // the deeper trees use the kernels for any depth
+    const size_t idx = (treeDepth <= maxUnrolledDepth)? treeDepth : 0;
+    switch (isa) {
+    case Isa::Avx512:
+        return avx512[idx];
+    case Isa::Avx2:
+        return avx2[idx];
+    default:
+        return scalar[idx];
+    }
+}
+
+
+template <class In_t>
+void PredictKernels::addTrees(const Isa isa, const Forest& forest,
+    const size_t treeFrom, const size_t treeTo,
+    const In_t* x, const ptrdiff_t rowStride, const ptrdiff_t colStride,
+    const size_t rowFrom, const size_t rowTo, Lab_t* out) {
+    getKernel<In_t>(isa, forest.treeDepth)(forest, treeFrom, treeTo, x,
+        rowStride, colStride, rowFrom, rowTo, out);
+}
+
+
+template <class In_t, size_t Depth>
+void PredictKernels::addTreesScalar(const Forest& forest,
+    const size_t treeFrom, const size_t treeTo,
+    const In_t* x, const ptrdiff_t rowStride, const ptrdiff_t colStride,
+    const size_t rowFrom, const size_t rowTo, Lab_t* out) {
+    const size_t treeDepth = (Depth != 0)? Depth : forest.treeDepth;
+    const size_t innerNodes = (size_t(1) << treeDepth) - 1;
+    const size_t leafCnt = size_t(1) << treeDepth;
+    for (size_t i = rowFrom; i < rowTo; ++i) {
+        const In_t* row = x + ptrdiff_t(i) * rowStride;
+        Lab_t acc = out[i];
+        const FIdx_t* curFeatures = forest.features + treeFrom * treeDepth;
+        const FVal_t* curThresholds = forest.thresholds + treeFrom * innerNodes;
+        const Lab_t* curLeaves = forest.leaves + treeFrom * leafCnt;
+        for (size_t tr = treeFrom; tr < treeTo; ++tr) {
+            size_t curNode = 0;
+            REGBM_UNROLL_LEVELS
+            for (size_t h = 0; h < treeDepth; ++h) {
+                const FVal_t val = row[ptrdiff_t(curFeatures[h]) * colStride];
+                curNode = 2 * curNode + 2 - size_t(val < curThresholds[curNode]);
+            }
+            acc += curLeaves[curNode - innerNodes];
+            curFeatures += treeDepth;
+            curThresholds += innerNodes;
+            curLeaves += leafCnt;
+        }
+        out[i] = acc;
+    }
+}
+
+
+#ifdef REGBM_X86_KERNELS
+
+// values of 4 rows (offsets are in elements) as doubles
+__attribute__((target("avx2")))
+static inline __m256d gather4(const double* base, const __m256i offsets) {
+    return _mm256_i64gather_pd(base, offsets, sizeof(double));
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256d gather4(const float* base, const __m256i offsets) {
+    return _mm256_cvtps_pd(_mm256_i64gather_ps(base, offsets, sizeof(float)));
+}
+
+
+// values of 8 rows as doubles; the masked forms with all the lanes on
+// are the same instructions, but GCC doesn't warn that the undefined
+// source of _mm512_i64gather_* or _mm512_cvtps_pd may be uninitialized
+__attribute__((target("avx512f")))
+static inline __m512d gather8(const double* base, const __m512i offsets) {
+    return _mm512_mask_i64gather_pd(_mm512_setzero_pd(), 0xFF, offsets,
+        base, sizeof(double));
+}
+
+
+__attribute__((target("avx512f")))
+static inline __m512d gather8(const float* base, const __m512i offsets) {
+    return _mm512_maskz_cvtps_pd(0xFF, _mm512_mask_i64gather_ps(
+        _mm256_setzero_ps(), 0xFF, offsets, base, sizeof(float)));
+}
+
+
+template <class In_t, size_t Depth>
+__attribute__((target("avx2")))
+void PredictKernels::addTreesAvx2(const Forest& forest,
+    const size_t treeFrom, const size_t treeTo,
+    const In_t* x, const ptrdiff_t rowStride, const ptrdiff_t colStride,
+    const size_t rowFrom, const size_t rowTo, Lab_t* out) {
+    const size_t treeDepth = (Depth != 0)? Depth : forest.treeDepth;
+    const size_t innerNodes = (size_t(1) << treeDepth) - 1;
+    const size_t leafCnt = size_t(1) << treeDepth;
+    const size_t lanes = 4;
+    // offsets of 4 neighbouring rows
+    const __m256i rowOffsets = _mm256_set_epi64x(3 * rowStride,
+        2 * rowStride, rowStride, 0);
+    const __m256i two = _mm256_set1_epi64x(2);
+    const __m256i leafShift = _mm256_set1_epi64x((long long)innerNodes);
+    size_t i = rowFrom;
+    for (; i + lanes <= rowTo; i += lanes) {
+        const In_t* rows = x + ptrdiff_t(i) * rowStride;
+        __m256d acc = _mm256_loadu_pd(out + i);
+        const FIdx_t* curFeatures = forest.features + treeFrom * treeDepth;
+        const FVal_t* curThresholds = forest.thresholds + treeFrom * innerNodes;
+        const Lab_t* curLeaves = forest.leaves + treeFrom * leafCnt;
+        for (size_t tr = treeFrom; tr < treeTo; ++tr) {
+            __m256i curNode = _mm256_setzero_si256();
+            size_t h = 0;
+            if (treeDepth > 0) {
+                // all samples are in the root, its threshold isn't gathered
+                const __m256d val = gather4(
+                    rows + ptrdiff_t(curFeatures[0]) * colStride, rowOffsets);
+                const __m256i goLeft = _mm256_castpd_si256(_mm256_cmp_pd(val,
+                    _mm256_set1_pd(curThresholds[0]), _CMP_LT_OQ));
+                curNode = _mm256_add_epi64(two, goLeft);
+                h = 1;
+            }
+            for (; h < treeDepth; ++h) {
+                const __m256d val = gather4(
+                    rows + ptrdiff_t(curFeatures[h]) * colStride, rowOffsets);
+                const __m256d thr = _mm256_i64gather_pd(curThresholds,
+                    curNode, 8);
+                // all ones (-1) if the sample goes left, NaN goes right
+                const __m256i goLeft = _mm256_castpd_si256(
+                    _mm256_cmp_pd(val, thr, _CMP_LT_OQ));
+                curNode = _mm256_add_epi64(_mm256_add_epi64(curNode, curNode), two);
+                curNode = _mm256_add_epi64(curNode, goLeft);
+            }
+            curNode = _mm256_sub_epi64(curNode, leafShift);
+            acc = _mm256_add_pd(acc, _mm256_i64gather_pd(curLeaves, curNode, 8));
+            curFeatures += treeDepth;
+            curThresholds += innerNodes;
+            curLeaves += leafCnt;
+        }
+        _mm256_storeu_pd(out + i, acc);
+    }
+    // the tail
+    addTreesScalar<In_t, Depth>(forest, treeFrom, treeTo, x, rowStride,
+        colStride, i, rowTo, out);
+}
+
+
+template <class In_t, size_t Depth>
+__attribute__((target("avx512f")))
+void PredictKernels::addTreesAvx512(const Forest& forest,
+    const size_t treeFrom, const size_t treeTo,
+    const In_t* x, const ptrdiff_t rowStride, const ptrdiff_t colStride,
+    const size_t rowFrom, const size_t rowTo, Lab_t* out) {
+    const size_t treeDepth = (Depth != 0)? Depth : forest.treeDepth;
+    const size_t innerNodes = (size_t(1) << treeDepth) - 1;
+    const size_t leafCnt = size_t(1) << treeDepth;
+    const size_t lanes = 8;
+    // offsets of 8 neighbouring rows
+    const __m512i rowOffsets = _mm512_set_epi64(7 * rowStride,
+        6 * rowStride, 5 * rowStride, 4 * rowStride, 3 * rowStride,
+        2 * rowStride, rowStride, 0);
+    const __m512i one = _mm512_set1_epi64(1);
+    const __m512i two = _mm512_set1_epi64(2);
+    const __m512i leafShift = _mm512_set1_epi64((long long)innerNodes);
+    size_t i = rowFrom;
+    for (; i + lanes <= rowTo; i += lanes) {
+        const In_t* rows = x + ptrdiff_t(i) * rowStride;
+        __m512d acc = _mm512_loadu_pd(out + i);
+        const FIdx_t* curFeatures = forest.features + treeFrom * treeDepth;
+        const FVal_t* curThresholds = forest.thresholds + treeFrom * innerNodes;
+        const Lab_t* curLeaves = forest.leaves + treeFrom * leafCnt;
+        for (size_t tr = treeFrom; tr < treeTo; ++tr) {
+            __m512i curNode = _mm512_setzero_si512();
+            size_t h = 0;
+            if (treeDepth > 0) {
+                // all samples are in the root, its threshold isn't gathered
+                const __m512d val = gather8(
+                    rows + ptrdiff_t(curFeatures[0]) * colStride, rowOffsets);
+                const __mmask8 goLeft = _mm512_cmp_pd_mask(val,
+                    _mm512_set1_pd(curThresholds[0]), _CMP_LT_OQ);
+                curNode = _mm512_mask_sub_epi64(two, goLeft, two, one);
+                h = 1;
+            }
+            for (; h < treeDepth; ++h) {
+                const __m512d val = gather8(
+                    rows + ptrdiff_t(curFeatures[h]) * colStride, rowOffsets);
+                const __m512d thr = gather8(curThresholds, curNode);
+                // NaN goes right
+                const __mmask8 goLeft = _mm512_cmp_pd_mask(val, thr, _CMP_LT_OQ);
+                curNode = _mm512_add_epi64(_mm512_add_epi64(curNode, curNode), two);
+                curNode = _mm512_mask_sub_epi64(curNode, goLeft, curNode, one);
+            }
+            curNode = _mm512_sub_epi64(curNode, leafShift);
+            acc = _mm512_add_pd(acc, gather8(curLeaves, curNode));
+            curFeatures += treeDepth;
+            curThresholds += innerNodes;
+            curLeaves += leafCnt;
+        }
+        _mm512_storeu_pd(out + i, acc);
+    }
+    // the tail
+    addTreesScalar<In_t, Depth>(forest, treeFrom, treeTo, x, rowStride,
+        colStride, i, rowTo, out);
+}
+
+#else
+
+// no vector kernels for this target
+template <class In_t, size_t Depth>
+void PredictKernels::addTreesAvx2(const Forest& forest,
+    const size_t treeFrom, const size_t treeTo,
+    const In_t* x, const ptrdiff_t rowStride, const ptrdiff_t colStride,
+    const size_t rowFrom, const size_t rowTo, Lab_t* out) {
+    addTreesScalar<In_t, Depth>(forest, treeFrom, treeTo, x, rowStride,
+        colStride, rowFrom, rowTo, out);
+}
+
+
+template <class In_t, size_t Depth>
+void PredictKernels::addTreesAvx512(const Forest& forest,
+    const size_t treeFrom, const size_t treeTo,
+    const In_t* x, const ptrdiff_t rowStride, const ptrdiff_t colStride,
+    const size_t rowFrom, const size_t rowTo, Lab_t* out) {
+    addTreesScalar<In_t, Depth>(forest, treeFrom, treeTo, x, rowStride,
+        colStride, rowFrom, rowTo, out);
+}
+
+#endif // REGBM_X86_KERNELS
+
+
+// the input types
+template PredictKernels::AddTrees_t<double> PredictKernels::getKernel<double>(
+    const Isa isa, const size_t treeDepth);
+template PredictKernels::AddTrees_t<float> PredictKernels::getKernel<float>(
+    const Isa isa, const size_t treeDepth);
+template void PredictKernels::addTrees<double>(const Isa isa,
+    const Forest& forest, const size_t treeFrom, const size_t treeTo,
+    const double* x, const ptrdiff_t rowStride, const ptrdiff_t colStride,
+    const size_t rowFrom, const size_t rowTo, Lab_t* out);
+template void PredictKernels::addTrees<float>(const Isa isa,
+    const Forest& forest, const size_t treeFrom, const size_t treeTo,
+    const float* x, const ptrdiff_t rowStride, const ptrdiff_t colStride,
+    const size_t rowFrom, const size_t rowTo, Lab_t* out);
@@ -0,0 +1,86 @@
+#ifndef PREDICT_KERNELS_H_INCLUDED
+#define PREDICT_KERNELS_H_INCLUDED
+
+#include "AtomicTypes.h"
+#include <cstddef>
+#include <utility>
+
+
+// Batch prediction of the packed oblivious trees.
+// Scalar, AVX2 (4 rows at once) and AVX-512 (8 rows at once) versions,
+// the vector ones are built only for x86 GCC/Clang and are chosen
+// at runtime depending on the CPU.
+// The input may be double (FVal_t) or float, floats are compared
+// with the thresholds after the exact conversion to double
+class PredictKernels {
+public:
+    enum class Isa {
+        Scalar,
+        Avx2,
+        Avx512
+    };
+
+    // packed trees (see TreeHolder)
+    struct Forest {
+        const FIdx_t* features;
+        const FVal_t* thresholds;
+        const Lab_t* leaves;
+        size_t treeDepth;
+    };
+
+    // out[i] += predictions of trees [treeFrom; treeTo)
+    // for rows [rowFrom; rowTo), trees are added one by one in order;
+    // x(i, f) is x[i * rowStride + f * colStride]
+    template <class In_t>
+    using AddTrees_t = void (*)(const Forest& forest,
+        const size_t treeFrom, const size_t treeTo,
+        const In_t* x, const ptrdiff_t rowStride, const ptrdiff_t colStride,
+        const size_t rowFrom, const size_t rowTo, Lab_t* out);
+
+    // the best instruction set supported by this CPU
+    static Isa detectIsa();
+
+    // the kernel for the instruction set & the depth of the trees:
+    // depths up to maxUnrolledDepth have their own kernels with
+    // the unrolled levels, so choose it once for the model
+    // (treeDepth 0 gives the kernel for any depth)
+    template <class In_t>
+    static AddTrees_t<In_t> getKernel(const Isa isa, const size_t treeDepth);
+    static constexpr size_t maxUnrolledDepth = 12;
+
+    // getKernel(isa, forest.treeDepth)(forest, ...)
+    template <class In_t>
+    static void addTrees(const Isa isa, const Forest& forest,
+        const size_t treeFrom, const size_t treeTo,
+        const In_t* x, const ptrdiff_t rowStride, const ptrdiff_t colStride,
+        const size_t rowFrom, const size_t rowTo, Lab_t* out);
+private:
+    // only static members
+    PredictKernels() = delete;
+    ~PredictKernels() = delete;
+
+    // Depth is the depth of the trees or 0 for any depth
+    // (taken from the forest)
+    template <class In_t, size_t Depth>
+    static void addTreesScalar(const Forest& forest,
+        const size_t treeFrom, const size_t treeTo,
+        const In_t* x, const ptrdiff_t rowStride, const ptrdiff_t colStride,
+        const size_t rowFrom, const size_t rowTo, Lab_t* out);
+    template <class In_t, size_t Depth>
+    static void addTreesAvx2(const Forest& forest,
+        const size_t treeFrom, const size_t treeTo,
+        const In_t* x, const ptrdiff_t rowStride, const ptrdiff_t colStride,
+        const size_t rowFrom, const size_t rowTo, Lab_t* out);
+    template <class In_t, size_t Depth>
+    static void addTreesAvx512(const Forest& forest,
+        const size_t treeFrom, const size_t treeTo,
+        const In_t* x, const ptrdiff_t rowStride, const ptrdiff_t colStride,
+        const size_t rowFrom, const size_t rowTo, Lab_t* out);
+
+    // table of the kernels for Depth = 0, 1, ..., maxUnrolledDepth
+    template <class In_t, size_t... Depths>
+    static AddTrees_t<In_t> selectKernel(const Isa isa,
+        const size_t treeDepth, std::index_sequence<Depths...>);
+};
+
+#endif // PREDICT_KERNELS_H_INCLUDED
@@ -1,12 +0,0 @@
-#ifndef PYBIND_HEADER_H_INCLUDED
-#define PYBIND_HEADER_H_INCLUDED
-
-#include "pybind11/pybind11.h"
-
-#include "xtensor/xmath.hpp"
-#include "xtensor/xarray.hpp"
-#include "xtensor/xview.hpp"
-
-#include "xtensor-python/pytensor.hpp"
-
-#endif // PYBIND_HEADER_H_INCLUDED
@@ -0,0 +1,163 @@
+#include "QuantileSketch.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+QuantileSketch::QuantileSketch(const size_t maxSize): maxSize(maxSize) {
+    if (maxSize < 2)
+        throw std::runtime_error("Quantile sketch size must be at least 2");
+    buffer.reserve(maxSize);
+}
+
+
+void QuantileSketch::push(const FVal_t value) {
+    if (std::isnan(value))
+        return;
+    buffer.push_back(value);
+    if (buffer.size() >= maxSize)
+        flush();
+}
+
+
+void QuantileSketch::flush() {
+    if (buffer.empty())
+        return;
+    // exact summary of the buffer: distinct values with their counts
+    std::sort(buffer.begin(), buffer.end());
+    std::vector<Entry> exact;
+    size_t begin = 0;
+    while (begin < buffer.size()) {
+        size_t end = begin + 1;
+        while (end < buffer.size() && buffer[end] == buffer[begin])
+            ++end;
+        exact.push_back(Entry{buffer[begin], double(begin), double(end),
+            double(end - begin)});
+        begin = end;
+    }
+    buffer.clear();
+    combine(exact);
+    prune();
+}
+
+
+void QuantileSketch::merge(const QuantileSketch& other) {
+    if (!other.buffer.empty())
+        throw std::runtime_error("Merged quantile sketch was not flushed");
+    flush();
+    combine(other.summary);
+    prune();
+}
+
+
+size_t QuantileSketch::getCount() const {
+    if (summary.empty())
+        return 0;
+    return size_t(summary.back().rmax);
+}
+
+
+FVal_t QuantileSketch::quantile(const double q) const {
+    if (summary.empty())
+        return 0; // no values (or NaNs only)
+    // the first entry that may have the rank
+    const double rank = q * summary.back().rmax;
+    auto found = std::lower_bound(summary.begin(), summary.end(), rank,
+        [](const Entry& entry, const double r) {
+            return entry.rmax < r;
+        });
+    if (found == summary.end())
+        return summary.back().value;
+    return found->value;
+}
+
+
+double QuantileSketch::Entry::rminNext() const {
+    return rmin + wmin;
+}
+
+
+double QuantileSketch::Entry::rmaxPrev() const {
+    return rmax - wmin;
+}
+
+
+void QuantileSketch::combine(const std::vector<Entry>& other) {
+    if (other.empty())
+        return;
+    if (summary.empty()) {
+        summary = other;
+        return;
+    }
+    // merge two sorted summaries, the rank bounds of the value
+    // are the sums of its bounds in both summaries
+    const std::vector<Entry>& a = summary;
+    const std::vector<Entry>& b = other;
+    mergeBuffer.clear();
+    size_t i = 0;
+    size_t j = 0;
+    double aPrevRmin = 0;
+    double bPrevRmin = 0;
+    while (i < a.size() && j < b.size()) {
+        if (a[i].value == b[j].value) {
+            mergeBuffer.push_back(Entry{a[i].value, a[i].rmin + b[j].rmin,
+                a[i].rmax + b[j].rmax, a[i].wmin + b[j].wmin});
+            aPrevRmin = a[i].rminNext();
+            bPrevRmin = b[j].rminNext();
+            ++i;
+            ++j;
+        } else if (a[i].value < b[j].value) {
+            mergeBuffer.push_back(Entry{a[i].value, a[i].rmin + bPrevRmin,
+                a[i].rmax + b[j].rmaxPrev(), a[i].wmin});
+            aPrevRmin = a[i].rminNext();
+            ++i;
+        } else {
+            mergeBuffer.push_back(Entry{b[j].value, b[j].rmin + aPrevRmin,
+                b[j].rmax + a[i].rmaxPrev(), b[j].wmin});
+            bPrevRmin = b[j].rminNext();
+            ++j;
+        }
+    }
+    // the tails are greater than all values of the other summary
+    for (; i < a.size(); ++i)
+        mergeBuffer.push_back(Entry{a[i].value, a[i].rmin + bPrevRmin,
+            a[i].rmax + b.back().rmax, a[i].wmin});
+    for (; j < b.size(); ++j)
+        mergeBuffer.push_back(Entry{b[j].value, b[j].rmin + aPrevRmin,
+            b[j].rmax + a.back().rmax, b[j].wmin});
+    summary.swap(mergeBuffer);
+}
+
+
+void QuantileSketch::prune() {
+    if (summary.size() <= maxSize)
+        return;
+    // keep the entries closest to maxSize evenly spaced ranks
+    // (the first & the last ones are kept, so min & max are exact)
+    const std::vector<Entry>& src = summary;
+    mergeBuffer.clear();
+    mergeBuffer.push_back(src.front());
+    const double begin = src.front().rmax;
+    const double range = src.back().rmin - begin;
+    const size_t steps = maxSize - 1;
+    size_t i = 1;
+    size_t lastIdx = 0;
+    for (size_t k = 1; k < steps; ++k) {
+        const double doubleRank = 2 * (k * range / steps + begin);
+        // the first i such that the rank is before the middle of i + 1
+        while (i < src.size() - 1 &&
+            doubleRank >= src[i + 1].rmax + src[i + 1].rmin)
+            ++i;
+        if (i == src.size() - 1)
+            break;
+        const size_t chosen =
+            (doubleRank < src[i].rminNext() + src[i + 1].rmaxPrev())? i : i + 1;
+        if (chosen != lastIdx) {
+            mergeBuffer.push_back(src[chosen]);
+            lastIdx = chosen;
+        }
+    }
+    if (lastIdx != src.size() - 1)
+        mergeBuffer.push_back(src.back());
+    summary.swap(mergeBuffer);
+}
@@ -0,0 +1,49 @@
+#ifndef QUANTILE_SKETCH_H_INCLUDED
+#define QUANTILE_SKETCH_H_INCLUDED
+
+#include "AtomicTypes.h"
+#include <cstddef>
+#include <vector>
+
+
+// One-pass mergeable summary of a column for the approximate quantiles
+// (weighted quantile summary: sorted values with the bounds of their
+// ranks). The summary keeps at most maxSize entries, the rank error
+// is about (sample count) / maxSize; min and max are kept exactly
+class QuantileSketch {
+public:
+    QuantileSketch(const size_t maxSize);
+
+    void push(const FVal_t value); // NaNs are skipped
+    // add the buffered values to the summary (call after the last push)
+    void flush();
+    // add the summary of other values (of the same column)
+    void merge(const QuantileSketch& other);
+
+    size_t getCount() const; // pushed values (without NaNs)
+    // the value which rank is about q * getCount(), q in [0; 1]
+    FVal_t quantile(const double q) const;
+
+private:
+    struct Entry {
+        FVal_t value;
+        double rmin; // min rank of the value
+        double rmax; // max rank of the value
+        double wmin; // weight of the value (count of the duplicates)
+
+        double rminNext() const;
+        double rmaxPrev() const;
+    };
+
+    // fields
+    size_t maxSize;
+    std::vector<Entry> summary;
+    std::vector<FVal_t> buffer; // values pushed after the last flush
+    std::vector<Entry> mergeBuffer; // helper for merge
+
+    // methods
+    void combine(const std::vector<Entry>& other);
+    inline void prune();
+};
+
+#endif // QUANTILE_SKETCH_H_INCLUDED
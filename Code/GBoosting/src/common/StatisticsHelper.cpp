@@ -3,16 +3,16 @@
 #include <cmath>
 
 
-Lab_t StatisticsHelper::mean(const pytensorY& vals) {
-	size_t count = vals.shape(0);
+Lab_t StatisticsHelper::mean(const LVector& vals) {
+	size_t count = vals.size();
 	Lab_t curSum = 0;
-	for (auto& curVal : vals) {
-		curSum += curVal;
+	for (size_t i = 0; i < count; ++i) {
+		curSum += vals(i);
 	}
 	return curSum / count;
 }
 
-Lab_t StatisticsHelper::mean(const pytensorY& vals,
+Lab_t StatisticsHelper::mean(const LVector& vals,
 	const std::vector<size_t>& idxs) {
 	size_t count = idxs.size();
 	Lab_t curSum = 0;
@@ -22,11 +22,30 @@ Lab_t StatisticsHelper::mean(const pytensorY& vals,
 	return curSum / count;
 }
 
-Lab_t StatisticsHelper::maxAbs(const pytensorY& vals) {
+Lab_t StatisticsHelper::mean(const LVector& vals,
+	const size_t* idxs, const size_t count) {
+	Lab_t curSum = 0;
+	for (size_t i = 0; i < count; ++i) {
+		curSum += vals[idxs[i]];
+	}
+	return curSum / count;
+}
+
+Lab_t StatisticsHelper::sqDeviation(const LVector& vals,
+	const size_t* idxs, const size_t count, const Lab_t center) {
+	Lab_t curSum = 0;
+	for (size_t i = 0; i < count; ++i) {
+		const Lab_t deviation = vals[idxs[i]] - center;
+		curSum += deviation * deviation;
+	}
+	return curSum;
+}
+
+Lab_t StatisticsHelper::maxAbs(const LVector& vals) {
 	Lab_t curMax = 0;
-	for (auto& curVal : vals) {
-		if (abs(curVal) > curMax)
-			curMax = abs(curVal);
+	for (size_t i = 0; i < vals.size(); ++i) {
+		if (std::abs(vals(i)) > curMax)
+			curMax = std::abs(vals(i));
 	}
 	return curMax;
 }
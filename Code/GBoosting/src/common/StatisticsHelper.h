@@ -1,16 +1,20 @@
 #ifndef STATISTICS_HELPER_H
 #define STATISTICS_HELPER_H
 
-#include "PybindHeader.h"
 #include "Structs.h"
 #include <vector>
 
 class StatisticsHelper {
 public:
-	static Lab_t mean(const pytensorY& vals);
-	static Lab_t mean(const pytensorY& vals,
+	static Lab_t mean(const LVector& vals);
+	static Lab_t mean(const LVector& vals,
 		const std::vector<size_t>& idxs);
-	static Lab_t maxAbs(const pytensorY& vals);
+	static Lab_t mean(const LVector& vals,
+		const size_t* idxs, const size_t count);
+	// sum (vals[idx] - center)^2 over the subset
+	static Lab_t sqDeviation(const LVector& vals,
+		const size_t* idxs, const size_t count, const Lab_t center);
+	static Lab_t maxAbs(const LVector& vals);
 private:
 	StatisticsHelper();
 	~StatisticsHelper() = delete;
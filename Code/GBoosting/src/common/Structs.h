@@ -1,12 +1,14 @@
 #ifndef STRUCTS_H
 #define STRUCTS_H
 
-#include "PybindHeader.h"
+#include "ArrayViews.h"
 #include "AtomicTypes.h"
+#include <vector>
 
-using pytensor1 = xt::pytensor<FVal_t, 1>;
-using pytensor2 = xt::pytensor<FVal_t, 2>;
-using pytensorY = xt::pytensor<Lab_t, 1>;
-using pytensor2Y = xt::pytensor<Lab_t, 2>;
+// 1st dim - object number, 2nd dim - feature number
+using FMatrix = MatrixView<const FVal_t>;
+using FVector = VectorView<const FVal_t>; // a single sample
+using LVector = VectorView<const Lab_t>; // labels
+using Labels = std::vector<Lab_t>; // predictions, residuals, losses
 
 #endif // STRUCTS_H
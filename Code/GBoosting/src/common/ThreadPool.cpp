@@ -0,0 +1,105 @@
+#include "ThreadPool.h"
+#include <stdexcept>
+
+
+ThreadPool::ThreadPool(const size_t threadCnt): threadCnt(threadCnt),
+    stopping(false) {
+    if (threadCnt == 0)
+        throw std::runtime_error("Thread count was 0 (must be positive)");
+    // the caller thread is the last one
+    for (size_t i = 0; i + 1 < threadCnt; ++i)
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        stopping = true;
+    }
+    jobsCond.notify_all();
+    for (auto& curWorker : workers)
+        curWorker.join();
+}
+
+
+size_t ThreadPool::getThreadCount() const {
+    return threadCnt;
+}
+
+
+void ThreadPool::parallelFor(const size_t taskCnt,
+    const std::function<void(const size_t)>& task) {
+    if (taskCnt == 0)
+        return;
+    if (workers.empty() || taskCnt == 1) {
+        // nothing to share
+        for (size_t i = 0; i < taskCnt; ++i)
+            task(i);
+        return;
+    }
+
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->task = &task;
+    job->taskCnt = taskCnt;
+    job->nextTask = 0;
+    job->tasksDone = 0;
+    {
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        jobs.push_back(job);
+    }
+    jobsCond.notify_all();
+
+    // work in this thread too
+    runTasks(*job);
+
+    // wait until workers finish the tasks they took
+    {
+        std::unique_lock<std::mutex> lock(job->doneMutex);
+        job->doneCond.wait(lock, [&job]() {
+            return job->tasksDone == job->taskCnt;
+        });
+    }
+    if (job->error)
+        std::rethrow_exception(job->error);
+}
+
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(jobsMutex);
+            jobsCond.wait(lock, [this]() {
+                return stopping || !jobs.empty();
+            });
+            if (stopping)
+                return;
+            job = jobs.front();
+            if (job->nextTask >= job->taskCnt) {
+                // all tasks of the job are taken already
+                jobs.pop_front();
+                continue;
+            }
+        }
+        runTasks(*job);
+    }
+}
+
+
+void ThreadPool::runTasks(Job& job) {
+    for (size_t i = job.nextTask++; i < job.taskCnt; i = job.nextTask++) {
+        try {
+            (*job.task)(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(job.doneMutex);
+            if (!job.error)
+                job.error = std::current_exception();
+        }
+        if (++job.tasksDone == job.taskCnt) {
+            // the last task, wake up the caller
+            std::lock_guard<std::mutex> lock(job.doneMutex);
+            job.doneCond.notify_all();
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef THREAD_POOL_H_INCLUDED
+#define THREAD_POOL_H_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Long-lived workers shared by fit and predict.
+// The calling thread takes part in the work too, so the pool
+// for threadCnt threads owns (threadCnt - 1) workers
+class ThreadPool {
+public:
+    ThreadPool(const size_t threadCnt);
+    virtual ~ThreadPool();
+
+    size_t getThreadCount() const;
+
+    // call task(i) for each i in [0; taskCnt) and wait until all finish
+    // can be called from several threads at once
+    // the first exception thrown by a task is rethrown here
+    void parallelFor(const size_t taskCnt,
+        const std::function<void(const size_t)>& task);
+
+private:
+    // one parallelFor call
+    struct Job {
+        const std::function<void(const size_t)>* task;
+        size_t taskCnt;
+        std::atomic<size_t> nextTask;
+        std::atomic<size_t> tasksDone;
+        std::mutex doneMutex;
+        std::condition_variable doneCond;
+        std::exception_ptr error;
+    };
+
+    // fields
+    const size_t threadCnt;
+    std::vector<std::thread> workers;
+    std::deque<std::shared_ptr<Job>> jobs;
+    std::mutex jobsMutex;
+    std::condition_variable jobsCond;
+    bool stopping;
+
+    // methods
+    void workerLoop();
+    static void runTasks(Job& job);
+};
+
+#endif // THREAD_POOL_H_INCLUDED
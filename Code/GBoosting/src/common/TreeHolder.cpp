@@ -1,17 +1,23 @@
 #include "TreeHolder.h"
 #include "ParseHelper.h"
+#include <algorithm>
 #include <cstring>
 #include <iostream>
-#include <thread>
+#include <stdexcept>
 #include <vector>
 #include <math.h>
 
 
 TreeHolder::TreeHolder(const size_t treeDepth,
-    const size_t featureCnt, const size_t threadCnt):
+    const size_t featureCnt, std::shared_ptr<ThreadPool> threadPool):
     treeDepth(treeDepth), innerNodes((1 << treeDepth) - 1), featureCnt(featureCnt),
-    leafCnt(size_t(1) << treeDepth), threadCnt(threadCnt), treeCnt(0) {
+    leafCnt(size_t(1) << treeDepth), threadPool(threadPool),
+    isa(PredictKernels::detectIsa()),
+    kernel64(PredictKernels::getKernel<double>(isa, treeDepth)),
+    kernel32(PredictKernels::getKernel<float>(isa, treeDepth)), rowBlock(0), treeBlock(0), treeCnt(0),
+    mappedFile(nullptr) {
     // ctor
+    updateViews();
 }
 
 
@@ -20,6 +26,18 @@ TreeHolder::~TreeHolder() {
 }
 
 
+template <>
+PredictKernels::AddTrees_t<double> TreeHolder::getKernel<double>() const {
+    return kernel64;
+}
+
+
+template <>
+PredictKernels::AddTrees_t<float> TreeHolder::getKernel<float>() const {
+    return kernel32;
+}
+
+
 size_t TreeHolder::getTreeCount() const {
     return treeCnt;
 }
@@ -28,108 +46,150 @@ size_t TreeHolder::getTreeCount() const {
 void TreeHolder::newTree(const std::vector<size_t>& features,
     const std::vector<FVal_t>& thresholds,
     const std::vector<Lab_t>& leaves) {
+    validateWritable();
+    // append arrays to the packed trees
+    this->features.insert(this->features.end(), features.begin(),
+        features.begin() + treeDepth);
+    this->thresholds.insert(this->thresholds.end(), thresholds.begin(),
+        thresholds.begin() + innerNodes);
+    this->leaves.insert(this->leaves.end(), leaves.begin(),
+        leaves.begin() + leafCnt);
     ++treeCnt;
-    // copy arrays
-    this->features.push_back(features);
-    this->thresholds.push_back(thresholds);
-    this->leaves.push_back(leaves);
+    jit = nullptr;
+    native = nullptr;
     // this will fix errors
     // TODO: find out the reason for the wrong values
-    validateFeatures();
+    validateFeatures(treeCnt - 1);
+    updateViews();
 }
 
 
 void TreeHolder::popTree() {
+    validateWritable();
     // decrease tree count
     --treeCnt;
-
-    // pop vectors
-    features.pop_back();
-    thresholds.pop_back();
-    leaves.pop_back();
+    jit = nullptr;
+    native = nullptr;
+
+    // cut the last tree
+    features.resize(treeCnt * treeDepth);
+    thresholds.resize(treeCnt * innerNodes);
+    leaves.resize(treeCnt * leafCnt);
+    updateViews();
 }
 
 
-Lab_t TreeHolder::predictTree(const pytensor1& sample, 
+template <class In_t>
+Lab_t TreeHolder::predictTree(const VectorView<const In_t>& sample,
     const size_t treeNum) const {
     validateTreeNum(treeNum);
-    // get refs for faster access
-    const std::vector<size_t>& curFeatures = features[treeNum];
-    const std::vector<FVal_t>& curThresholds = thresholds[treeNum];
+    // get pointers for faster access
+    const FIdx_t* curFeatures = treeFeatures(treeNum);
+    const FVal_t* curThresholds = treeThresholds(treeNum);
+
+    const size_t leaf = findLeaf([&sample](const FIdx_t f) {
+        return sample(f);
+    }, curFeatures, curThresholds);
+    return treeLeaves(treeNum)[leaf];
+}
 
-    // TODO: use getCallback(...)
-    size_t curNode = 0;
-    // tree traverse
-    for (size_t h = 0; h < treeDepth; ++h) {
-        if (sample(curFeatures[h]) < curThresholds[curNode])
-            curNode = 2 * curNode + 1;
-        else
-            curNode = 2 * curNode + 2;
-    }
-    return leaves[treeNum][curNode - innerNodes];
-}
-
-
-void TreeHolder::predictTreeFit(const pytensor2& xTrain, const pytensor2& xValid,
-        const size_t treeNum, pytensorY& residuals, pytensorY& preds,
-        pytensorY& validRes, pytensorY& validPreds) const {
-    if (threadCnt > 1) {
-        predictFitMultithreaded(xTrain, xValid, treeNum,
-            residuals, preds, validRes, validPreds);
-    } else {
-        // predict on train subset
-        pytensorY curPred = predictTree2dSingleThread(xTrain, treeNum);
-        preds += curPred;
-        residuals -= curPred;
-        // predict on test subset
-        curPred = predictTree2dSingleThread(xValid, treeNum);
-        validPreds += curPred;
-        validRes -= curPred;
-    }
+
+template <class In_t>
+void TreeHolder::predictTreeFit(const MatrixView<const In_t>& xTrain,
+        const MatrixView<const In_t>& xValid,
+        const size_t treeNum, Labels& residuals, Labels& preds,
+        Labels& validRes, Labels& validPreds,
+        const uint32_t* trainLeaves) const {
+    // each batch updates its own part of predictions & residuals
+    // predict on train subset
+    forEachBatch(xTrain.shape(0), [&](const size_t bias, const size_t batchSize) {
+        predictBatch(bias, batchSize, treeNum, xTrain, residuals.data(),
+            preds.data(), trainLeaves);
+    });
+    // predict on validation subset
+    forEachBatch(xValid.shape(0), [&](const size_t bias, const size_t batchSize) {
+        predictBatch(bias, batchSize, treeNum, xValid, validRes.data(),
+            validPreds.data(), nullptr);
+    });
 }
 
 
-Lab_t TreeHolder::predictAllTrees(const pytensor1& sample) const {
+template <class In_t>
+Lab_t TreeHolder::predictAllTrees(const VectorView<const In_t>& sample) const {
+    if (jit != nullptr)
+        return jit->predictRow(sample.data(), sample.stride());
+    if (native != nullptr)
+        return native->predictRow(sample.data(), sample.stride());
     Lab_t curSum = 0;
-    for (size_t i = 0; i < treeCnt; ++i)
-        curSum += predictTree(sample, i);
+    addTrees(0, treeCnt, sample.data(), 0, sample.stride(), 0, 1, &curSum);
     return curSum;
 }
 
 
-pytensorY TreeHolder::predictAllTrees2d(const pytensor2& sample) const {
-    if (threadCnt == 1) {
-        pytensorY answers = xt::zeros<Lab_t>({sample.shape(0)});
-        for (size_t i = 0; i < treeCnt; ++i) {
-            answers += predictTree2dSingleThread(sample, i);
-        }
-        return answers;
-    } else {
-        return allTrees2dMultithreaded(sample);
-    }
+template <class In_t>
+void TreeHolder::predictAllTrees2d(const MatrixView<const In_t>& sample,
+    Lab_t* answers) const {
+    // the kernels add the trees to the answers
+    std::fill(answers, answers + sample.shape(0), Lab_t(0));
+    forEachBatch(sample.shape(0), [&](const size_t bias, const size_t batchSize) {
+        predictBatchAll(bias, batchSize, sample, answers);
+    });
 }
 
 
-Lab_t TreeHolder::predictFromTo(const pytensor1& sample, const size_t from,
-    const size_t to) const {
+template <class In_t>
+Lab_t TreeHolder::predictFromTo(const VectorView<const In_t>& sample,
+    const size_t from, const size_t to) const {
     Lab_t curSum = 0;
-    for (size_t i = from; i < to; ++i)
-        curSum += predictTree(sample, i);
+    addTrees(from, to, sample.data(), 0, sample.stride(), 0, 1, &curSum);
     return curSum;
 }
 
 
-pytensorY TreeHolder::predictTree2d(const pytensor2& xPred,
+Labels TreeHolder::predictTree2d(const FMatrix& xPred,
     const size_t treeNum) const {
     validateTreeNum(treeNum);
-    if (threadCnt > 1)
-        return predictTree2dMutlithreaded(xPred, treeNum);
-    else
-        return predictTree2dSingleThread(xPred, treeNum);
+    // array to store and return predictions
+    Labels answers(xPred.shape(0), 0);
+    forEachBatch(xPred.shape(0), [&](const size_t bias, const size_t batchSize) {
+        predictBatch(bias, batchSize, treeNum, xPred, answers.data());
+    });
+    return answers;
+}
+
+
+void TreeHolder::setPredictBlocks(const size_t rowBlock,
+    const size_t treeBlock) {
+    this->rowBlock = rowBlock;
+    this->treeBlock = treeBlock;
 }
 
 
-std::string TreeHolder::serialize(const char delimeter,
+void TreeHolder::compileJit(const std::string& cacheDir) {
+    const PredictKernels::Forest forest = {featuresView,
+        thresholdsView, leavesView, treeDepth};
+    jit = std::make_shared<const JitEnsemble>(forest, treeCnt, featureCnt,
+        cacheDir);
+}
+
+
+bool TreeHolder::emitNative() {
+    native = nullptr;
+    if (!NativeEnsemble::isSupported())
+        return false;
+    const PredictKernels::Forest forest = {featuresView,
+        thresholdsView, leavesView, treeDepth};
+    try {
+        native = std::make_shared<const NativeEnsemble>(forest, treeCnt,
+            featureCnt);
+    } catch (const std::runtime_error&) {
+        return false; // e.g. executable memory is forbidden
+    }
+    return true;
+}
+
+
+void TreeHolder::serialize(ModelWriter& out, const char delimeter,
     const Lab_t zeroPredictor) const {
     // Answer structure:
 	// <TreeCount><d><TreeDepth><d><zeroPredictor><d><Trees>
@@ -142,13 +202,15 @@ std::string TreeHolder::serialize(const char delimeter,
 	// <Threshold> ::= <FVal_t number>
 	// <Leaf> ::= <Lab_t number>
     // <d> ::= delimeter
-    std::string ans;
     // <TreeCount><d>
-    ans += std::to_string(treeCnt) + delimeter;
+    out.writeSizeT(treeCnt);
+    out.write(delimeter);
     // <TreeDepth><d>
-    ans += std::to_string(treeDepth) + delimeter;
+    out.writeSizeT(treeDepth);
+    out.write(delimeter);
     // <zeroPredictor>
-    ans += std::to_string(zeroPredictor);
+    // numbers are written in the shortest form that is read back exactly
+    out.writeFloat(zeroPredictor);
 
     // <d><Trees>
     for (size_t i = 0; i < treeCnt; ++i) {
@@ -156,29 +218,30 @@ std::string TreeHolder::serialize(const char delimeter,
         // <d><Features>
         for (size_t j = 0; j < treeDepth; ++j) {
             // <d><Feature>
-            ans += delimeter + std::to_string(features[i][j]);
+            out.write(delimeter);
+            out.writeSizeT(featuresView[i * treeDepth + j]);
         }
         // <d><Thresholds>
         for (size_t j = 0; j < innerNodes; ++j) {
             // <d><Threshold>
-            ans += delimeter + std::to_string(thresholds[i][j]);
+            out.write(delimeter);
+            out.writeFloat(thresholdsView[i * innerNodes + j]);
         }
         // <d><Leaves>
         for (size_t j = 0; j < leafCnt; ++j) {
             // <d><Leaf>
-            ans += delimeter + std::to_string(leaves[i][j]);
+            out.write(delimeter);
+            out.writeFloat(leavesView[i * leafCnt + j]);
         }
     }
-
-    return ans;
 }
 
 
-TreeHolder* TreeHolder::parse(const char* repr,
-    const std::vector<size_t> delimPos,
+TreeHolder* TreeHolder::parse(const char* repr, const char* reprEnd,
+    const std::vector<size_t>& delimPos,
     const size_t delimStart, const size_t featureCnt,
     const size_t treeCnt, const size_t treeDepth,
-    const size_t threadCnt) {
+    std::shared_ptr<ThreadPool> threadPool) {
     // File structure:
 	// <Type><d><FeatureCnt><d><TreeCount><d><TreeDepth><d><zeroPredictor><d><Trees><e>
 	// <Type> ::= 0 | 1  # 0 for classification, 1 for regression
@@ -193,320 +256,382 @@ TreeHolder* TreeHolder::parse(const char* repr,
 	// <d> ::= ;  # delimeter
 	// <e> ::= !  # end
 
-    TreeHolder* forest = new TreeHolder(treeDepth, featureCnt,
-        threadCnt);
+    // freed if the parser throws
+    std::unique_ptr<TreeHolder> forest(new TreeHolder(treeDepth, featureCnt,
+        threadPool));
     if (forest == nullptr)
         return nullptr; // don't throw from here
 
     // allocate memory for the trees
     forest->treeCnt = treeCnt;
-    forest->features = std::vector<std::vector<size_t>>(treeCnt, std::vector<size_t>());
-    forest->thresholds = std::vector<std::vector<FVal_t>>(treeCnt, std::vector<FVal_t>());
-    forest->leaves = std::vector<std::vector<Lab_t>>(treeCnt, std::vector<Lab_t>());
     size_t innerNodes = forest->innerNodes;
     size_t leafCnt = forest->leafCnt;
+    forest->features = AlignedVector<FIdx_t>(treeCnt * treeDepth, 0);
+    forest->thresholds = AlignedVector<FVal_t>(treeCnt * innerNodes, 0);
+    forest->leaves = AlignedVector<Lab_t>(treeCnt * leafCnt, 0);
 
     // parse trees
     size_t curd = delimStart;
     for (size_t i = 0; i < treeCnt; ++i) {
         // <Tree> ::= <Features><d><Thresholds><d><Leaves>
         // parse features
-        // TODO: allocate once, before the cycle
-        std::vector<size_t> fArr(treeDepth, 0);
-        std::vector<FVal_t> tArr(innerNodes, 0);
-        std::vector<Lab_t> lArr(leafCnt, 0);
+        FIdx_t* fArr = forest->features.data() + i * treeDepth;
+        FVal_t* tArr = forest->thresholds.data() + i * innerNodes;
+        Lab_t* lArr = forest->leaves.data() + i * leafCnt;
         for (size_t j = 0; j < treeDepth; ++j) {
-            fArr[j] = ParseHelper::parseSizeT(repr + delimPos[curd++]);
+            fArr[j] = (FIdx_t)ParseHelper::parseSizeT(repr + delimPos[curd++],
+                reprEnd);
         }
-        forest->features[i] = fArr;
         // parse thresholds
         for (size_t j = 0; j < innerNodes; ++j) {
-            tArr[j] = (FVal_t)ParseHelper::parseFloat(repr + delimPos[curd++]);
+            tArr[j] = (FVal_t)ParseHelper::parseFloat(repr + delimPos[curd++],
+                reprEnd);
         }
-        forest->thresholds[i] = tArr;
         // parse leaves
         for (size_t j = 0; j < leafCnt; ++j) {
-            lArr[j] = (Lab_t)ParseHelper::parseFloat(repr + delimPos[curd++]);
+            lArr[j] = (Lab_t)ParseHelper::parseFloat(repr + delimPos[curd++],
+                reprEnd);
         }
-        forest->leaves[i] = lArr;
+        // wrong features would lead to reading out of the sample
+        forest->validateFeatures(i);
     }
+    forest->updateViews();
 
-    return forest;
+    return forest.release();
 }
 
 
-void TreeHolder::validateFeatures() {
-    for (auto & curFeatureArr: features) {
-        for (size_t h = 0; h < treeDepth; ++h) {
-            if (curFeatureArr[h] >= featureCnt)
-                // too big value
-                curFeatureArr[h] = featureCnt - 1;
+void TreeHolder::writeBinary(std::ostream& out,
+    BinaryModelHeader header) const {
+    const size_t align = BinaryModelHeader::sectionAlignment;
+    const size_t featuresBytes = treeCnt * treeDepth * sizeof(FIdx_t);
+    const size_t thresholdsBytes = treeCnt * innerNodes * sizeof(FVal_t);
+    const size_t leavesBytes = treeCnt * leafCnt * sizeof(Lab_t);
+    auto alignUp = [align](const size_t offset) {
+        return (offset + align - 1) / align * align;
+    };
+    // fill the tree part of the header
+    header.version = BinaryModelHeader::currentVersion;
+    header.byteOrder = BinaryModelHeader::byteOrderMark;
+    header.featureIdxSize = sizeof(FIdx_t);
+    header.featureValSize = sizeof(FVal_t);
+    header.labelSize = sizeof(Lab_t);
+    header.featureCnt = featureCnt;
+    header.treeCnt = treeCnt;
+    header.treeDepth = treeDepth;
+    header.featuresOffset = alignUp(sizeof(BinaryModelHeader));
+    header.thresholdsOffset = alignUp(header.featuresOffset + featuresBytes);
+    header.leavesOffset = alignUp(header.thresholdsOffset + thresholdsBytes);
+    header.fileSize = header.leavesOffset + leavesBytes;
+
+    // write the sections with zero padding between them
+    static const char padding[BinaryModelHeader::sectionAlignment] = {};
+    size_t written = 0;
+    auto writeSection = [&](const size_t offset, const void* src,
+        const size_t bytes) {
+        out.write(padding, std::streamsize(offset - written));
+        out.write((const char*)src, std::streamsize(bytes));
+        written = offset + bytes;
+    };
+    writeSection(0, &header, sizeof(BinaryModelHeader));
+    writeSection(header.featuresOffset, featuresView, featuresBytes);
+    writeSection(header.thresholdsOffset, thresholdsView, thresholdsBytes);
+    writeSection(header.leavesOffset, leavesView, leavesBytes);
+    if (!out)
+        throw std::runtime_error("Error occurred while writing the file");
+}
+
+
+TreeHolder* TreeHolder::fromMapped(std::shared_ptr<MappedFile> file,
+    const BinaryModelHeader& header,
+    std::shared_ptr<ThreadPool> threadPool) {
+    // header is already checked by the caller (magic, version, byte order)
+    if (header.featureIdxSize != sizeof(FIdx_t) ||
+        header.featureValSize != sizeof(FVal_t) ||
+        header.labelSize != sizeof(Lab_t))
+        throw std::runtime_error("Can't load model: unsupported number types");
+    if (header.featureCnt == 0 || header.treeDepth == 0 ||
+        header.treeDepth >= 8 * sizeof(size_t) - 1)
+        throw std::runtime_error("Can't load model: invalid file");
+    const size_t treeCnt = header.treeCnt;
+    const size_t treeDepth = header.treeDepth;
+    const size_t innerNodes = (size_t(1) << treeDepth) - 1;
+    const size_t leafCnt = size_t(1) << treeDepth;
+    // sections must be aligned and lie inside the file
+    auto validSection = [&](const uint64_t offset, const size_t itemSize,
+        const size_t itemCnt) {
+        if (offset % BinaryModelHeader::sectionAlignment != 0 ||
+            offset > header.fileSize)
+            return false;
+        return itemCnt == 0 || (header.fileSize - offset) / itemCnt >= itemSize;
+    };
+    // each tree takes more than a byte, it protects from overflows below
+    if (header.fileSize != file->size() || treeCnt > header.fileSize ||
+        !validSection(header.featuresOffset, sizeof(FIdx_t), treeCnt * treeDepth) ||
+        !validSection(header.thresholdsOffset, sizeof(FVal_t), treeCnt * innerNodes) ||
+        !validSection(header.leavesOffset, sizeof(Lab_t), treeCnt * leafCnt))
+        throw std::runtime_error("Can't load model: invalid file");
+
+    TreeHolder* forest = new TreeHolder(treeDepth, header.featureCnt,
+        threadPool);
+    forest->treeCnt = treeCnt;
+    forest->mappedFile = file;
+    forest->updateViews();
+    // the mapping is read-only, so wrong features can't be fixed here
+    for (size_t i = 0; i < treeCnt * treeDepth; ++i) {
+        if (forest->featuresView[i] >= header.featureCnt) {
+            delete forest;
+            throw std::runtime_error("Can't load model: invalid file");
         }
     }
+    return forest;
+}
+
+
+void TreeHolder::validateFeatures(const size_t treeNum) {
+    FIdx_t* curFeatureArr = features.data() + treeNum * treeDepth;
+    for (size_t h = 0; h < treeDepth; ++h) {
+        if (curFeatureArr[h] >= featureCnt)
+            // too big value
+            curFeatureArr[h] = FIdx_t(featureCnt - 1);
+    }
 }
 
 
 void TreeHolder::validateTreeNum(const size_t treeNum) const {
-    if (treeNum >= features.size())
-        throw std::runtime_error("wrong treeNum");
-    if (treeNum >= thresholds.size())
-        throw std::runtime_error("wrong treeNum");
-    if (treeNum >= leaves.size())
+    if (treeNum >= treeCnt)
         throw std::runtime_error("wrong treeNum");
 }
 
 
-pytensorY TreeHolder::predictTree2dSingleThread(const pytensor2& xPred,
-    const size_t treeNum) const {
-    // get refs for faster access
-    const std::vector<size_t>& curFeatures = features[treeNum];
-    const std::vector<FVal_t>& curThresholds = thresholds[treeNum];
-    const size_t sampleCnt = xPred.shape(0);
-
-    // tensor to store and return predictions
-    pytensorY answers = xt::zeros<Lab_t>({sampleCnt});
-
-    // use code defined in getCallback(...)
-    size_t semFict = 1; // don't need to acqiure/release lock
-    getCallback(0, sampleCnt, treeNum, xPred, semFict,
-        answers)(); // get & launch
-    return answers;
+void TreeHolder::validateWritable() const {
+    if (mappedFile != nullptr)
+        throw std::runtime_error("The model mapped from file is read-only");
 }
 
 
-pytensorY TreeHolder::predictTree2dMutlithreaded(const pytensor2& xPred,
-    const size_t treeNum) const {
-    static const bool allTrees = false;
-    return predict2dProxy(xPred, allTrees, treeNum);
-}
-
-
-void TreeHolder::predictFitMultithreaded(const pytensor2& xTrain, const pytensor2& xValid,
-        const size_t treeNum, pytensorY& residuals, pytensorY& preds,
-        pytensorY& validRes, pytensorY& validPreds) const {
-    // part of threads -> train, part -> valid
-    // compute the parts
-    std::vector<std::thread> threads;
-    const size_t trainLen = xTrain.shape(0);
-    const size_t validLen = xValid.shape(0);
-    const size_t commonLen = trainLen + validLen;
-    size_t threadsForValid = (size_t)(floor((threadCnt * (double)(validLen) / (double)(commonLen))));
-    // max(threadsForValid, 1)
-    // at least one thread
-    threadsForValid = (threadsForValid > 1)? (threadsForValid) : (1);
-    size_t threadsForTrain = threadCnt - threadsForValid;
-
-    // semaphore (to wait until threads finish)
-    size_t semThreadsFinish = threadCnt;
-    const size_t semUnlocked = 0;
-
-    // prepare train threads
-    // each thread will predict on it's own batch
-    size_t bias; // bias of the batch
-    size_t batchSize = trainLen / threadsForTrain;
-    // the size of the last batch (it may differ)
-    size_t lastBatchSize = trainLen - (threadsForTrain - 1) * batchSize;
-    // tensor to store and return predictions
-    pytensorY trainPreds = xt::zeros<Lab_t>({trainLen});
-    for (size_t i = 0; i < threadsForTrain - 1; ++i) {
-        bias = i * batchSize; // compute batch bias
-        threads.push_back(std::thread(getCallback(bias, batchSize,
-            treeNum, xTrain, semThreadsFinish, trainPreds)));
-        threads[i].detach(); // launch the thread
-    }
-    // predict on the last train batch
-    bias = (threadsForTrain - 1) * batchSize;
-    auto lastThread = getCallback(bias, batchSize, treeNum,
-        xTrain, semThreadsFinish, trainPreds);
-    threads.push_back(std::thread(lastThread));
-    threads[threadsForTrain - 1].detach();
-
-    // prepare validation threads
-    // each thread will predict on it's own batch
-    size_t biasValid; // bias of the batch
-    size_t batchSizeValid = validLen / threadsForValid;
-    // the size of the last batch (it may differ)
-    size_t lastBatchSizeVal = validLen - (threadsForValid - 1) * batchSizeValid;
-    // tensor to store and return predictions
-    pytensorY predsForValid = xt::zeros<Lab_t>({validLen});
-    for (size_t i = 0; i < threadsForValid - 1; ++i) {
-        biasValid = i * batchSizeValid; // compute batch bias
-        threads.push_back(std::thread(getCallback(biasValid, batchSizeValid,
-            treeNum, xValid, semThreadsFinish, predsForValid)));
-        threads[i + threadsForTrain].detach(); // launch the thread
+void TreeHolder::updateViews() {
+    if (mappedFile == nullptr) {
+        featuresView = features.data();
+        thresholdsView = thresholds.data();
+        leavesView = leaves.data();
+        return;
     }
-    // predict on the last valid batch
-    // we will process the last batch in this thread (main)
-    biasValid = (threadsForValid - 1) * batchSizeValid;
-    getCallback(biasValid, lastBatchSizeVal, treeNum, xValid,
-        semThreadsFinish, predsForValid)(); // get & launch
-
-    while (semThreadsFinish > semUnlocked) {
-        // busy wait (until threads finishes predictions)
-        std::this_thread::sleep_for(std::chrono::milliseconds(busyWaitMs));
-    }
-    // now all predictions have been aggregated, can update residuals and predictions
-
-    // one thread for train, one for validation
-    // validation will be updated in the main thread
-    semThreadsFinish = 1;
-    // train
-    std::thread trainThread = std::thread([&]() {
-        preds += trainPreds;
-        residuals -= trainPreds;
-        semThreadsFinish -= 1;
-    });
-    trainThread.detach();
-    // validation
-    validPreds += predsForValid;
-    validRes -= predsForValid;
-    
-    while (semThreadsFinish > semUnlocked) {
-        // busy wait (until train updates finish)
-        std::this_thread::sleep_for(std::chrono::milliseconds(busyWaitMs));
-    }
-    // now all updates performed
+    // the file is checked by fromMapped
+    const BinaryModelHeader* header =
+        (const BinaryModelHeader*)mappedFile->data();
+    featuresView = (const FIdx_t*)(mappedFile->data() + header->featuresOffset);
+    thresholdsView = (const FVal_t*)(mappedFile->data() + header->thresholdsOffset);
+    leavesView = (const Lab_t*)(mappedFile->data() + header->leavesOffset);
 }
 
 
-pytensorY TreeHolder::allTrees2dMultithreaded(const pytensor2& xPred) const {
-    static const bool allTrees = true;
-    static const size_t treeNumStub = 0;
-    return predict2dProxy(xPred, allTrees, treeNumStub);
+const FIdx_t* TreeHolder::treeFeatures(const size_t treeNum) const {
+    return featuresView + treeNum * treeDepth;
 }
 
 
-pytensorY TreeHolder::predict2dProxy(const pytensor2& xPred,
-        const bool allTrees, const size_t treeNum) const {
-    // decide which callback to get
-    std::function<void()> (TreeHolder::*callbackGetter)(const size_t bias,
-        const size_t batchSize, const size_t treeNum,
-        const pytensor2& xPred, size_t& semThreadsFinish,
-        pytensorY& answers) const;
-    if (allTrees) {
-        callbackGetter = &TreeHolder::getCallbackAll;
-    }
-    else {
-        callbackGetter = &TreeHolder::getCallback;
+const FVal_t* TreeHolder::treeThresholds(const size_t treeNum) const {
+    return thresholdsView + treeNum * innerNodes;
+}
+
+
+const Lab_t* TreeHolder::treeLeaves(const size_t treeNum) const {
+    return leavesView + treeNum * leafCnt;
+}
+
+
+template <class In_t>
+size_t TreeHolder::getRowBlock() const {
+    if (rowBlock != 0)
+        return rowBlock;
+    // samples of the tile should stay in L1 while the trees are applied
+    const size_t rowBytes = featureCnt * sizeof(In_t) + sizeof(Lab_t);
+    size_t ans = rowBlockBytes / rowBytes;
+    ans = std::max(rowBlockMin, std::min(rowBlockMax, ans));
+    // keep the vector kernels busy
+    return ans - ans % 8;
+}
+
+
+size_t TreeHolder::getTreeBlock() const {
+    if (treeBlock != 0)
+        return treeBlock;
+    // trees of the tile should stay in L2 while the samples are processed
+    const size_t treeBytes = treeDepth * sizeof(FIdx_t) +
+        innerNodes * sizeof(FVal_t) + leafCnt * sizeof(Lab_t);
+    return std::max(size_t(1), treeBlockBytes / treeBytes);
+}
+
+
+template <class In_t>
+void TreeHolder::addTrees(const size_t treeFrom, const size_t treeTo,
+    const In_t* x, const ptrdiff_t rowStride, const ptrdiff_t colStride,
+    const size_t rowFrom, const size_t rowTo, Lab_t* out) const {
+    const PredictKernels::Forest forest = {featuresView,
+        thresholdsView, leavesView, treeDepth};
+    getKernel<In_t>()(forest, treeFrom, treeTo, x, rowStride, colStride,
+        rowFrom, rowTo, out);
+}
+
+
+template <class Value_t>
+size_t TreeHolder::findLeaf(const Value_t& value, const FIdx_t* curFeatures,
+    const FVal_t* curThresholds) const {
+    // all nodes of the level h split by the same feature, so the value
+    // is loaded once per level; nodes are stored in heap order
+    size_t curNode = 0;
+    for (size_t h = 0; h < treeDepth; ++h) {
+        const FVal_t x = value(curFeatures[h]);
+        // left son is 2 * node + 1, right son is 2 * node + 2;
+        // (x < t) is 1 only for the left son, NaN goes right
+        curNode = 2 * curNode + 2 - size_t(x < curThresholds[curNode]);
     }
+    return curNode - innerNodes;
+}
 
-    // predict
-    std::vector<std::thread> threads;
-    // init "semaphore" with the max value
-    // each thread will decrement the semaphore before finish
-    size_t semThreadsFinish = threadCnt;
-    static const size_t semUnlocked = 0;
 
+template <class Batch_t>
+void TreeHolder::forEachBatch(const size_t sampleCnt,
+    const Batch_t& batch) const {
     // each thread will predict on it's own batch
-    size_t bias; // bias of the batch
-    size_t batchSize = xPred.shape(0) / threadCnt;
-    // the size of the last batch (it may differ)
-    size_t lastBatchSize = xPred.shape(0) - (threadCnt - 1) * batchSize;
-    // tensor to store and return predictions
-    pytensorY answers = xt::zeros<Lab_t>({xPred.shape(0)});
-    // create threads for prediction
-    for (size_t i = 0; i < threadCnt - 1; ++i) {
-        bias = i * batchSize; // compute batch bias
-        // each thread has it's own unique callback
-        // (to avoid data races)
-        threads.push_back(std::thread((this->*callbackGetter)(bias, batchSize,
-            treeNum, xPred, semThreadsFinish, answers)));
-        threads[i].detach(); // launch the thread
-    }
-    // the last batch will be processed in this thread (main)
-    bias = (threadCnt - 1) * batchSize;
-    (this->*callbackGetter)(bias, lastBatchSize, treeNum, xPred,
-        semThreadsFinish, answers)(); // get & launch
-
-    while (semThreadsFinish > semUnlocked) {
-        // busy wait (until threads finishes predictions)
-        std::this_thread::sleep_for(std::chrono::milliseconds(busyWaitMs));
+    // small batches are not split (the pool overhead is greater)
+    const size_t batchCnt = std::min(threadPool->getThreadCount(),
+        (sampleCnt + minBatchSize - 1) / minBatchSize);
+    if (batchCnt <= 1) {
+        batch(0, sampleCnt);
+        return;
     }
-    // now all predictions have been aggregated, can return an answer
+    const size_t batchSize = sampleCnt / batchCnt;
+    threadPool->parallelFor(batchCnt, [&](const size_t i) {
+        const size_t bias = i * batchSize; // compute batch bias
+        // the size of the last batch may differ
+        batch(bias, (i + 1 == batchCnt)? (sampleCnt - bias) : batchSize);
+    });
+}
 
-    return answers;
+
+template <class In_t>
+void TreeHolder::predictBatch(const size_t bias, const size_t batchSize,
+    const size_t treeNum, const MatrixView<const In_t>& xPred,
+    Lab_t* answers) const {
+    const size_t upperLimit = batchSize + bias;
+    std::fill(answers + bias, answers + upperLimit, Lab_t(0));
+    addTrees(treeNum, treeNum + 1, xPred.data(), xPred.rowStride(),
+        xPred.colStride(), bias, upperLimit, answers);
 }
 
 
-std::function<void()> TreeHolder::getCallback(const size_t bias,
-    const size_t batchSize, const size_t treeNum,
-    const pytensor2& xPred, size_t& semThreadsFinish,
-    pytensorY& answers) const {
-    // get refs for faster access
-    const std::vector<size_t>& curFeatures = features[treeNum];
-    const std::vector<FVal_t>& curThresholds = thresholds[treeNum];
-    const std::vector<Lab_t>& curLeaves = leaves[treeNum];
-    // pass by values
-    const size_t treeDepth = this->treeDepth;
-    const size_t innerNodes = this->innerNodes;
-    // don't pass 'this' by reference, don't pass 'this' at all
-    // this is needed to avoid data races
-    return [curFeatures, curThresholds, curLeaves, treeDepth,
-        innerNodes, bias, batchSize, &xPred, &semThreadsFinish,
-        &answers]() mutable {
-        // compute the end of the batch
-        const size_t upperLimit = batchSize + bias;
-        size_t curNode = 0; // current node in the decision tree
-        // predict for all batch members
-        for (size_t j = bias; j < upperLimit; ++j) {
-            // decision tree traverse
-            for (size_t h = 0; h < treeDepth; ++h) {
-                if (xPred(j, curFeatures[h]) < curThresholds[curNode])
-                    curNode = 2 * curNode + 1;
-                else
-                    curNode = 2 * curNode + 2;
+template <class In_t>
+void TreeHolder::predictBatch(const size_t bias, const size_t batchSize,
+    const size_t treeNum, const MatrixView<const In_t>& xPred,
+    Lab_t* residuals, Lab_t* preds, const uint32_t* knownLeaves) const {
+    const size_t upperLimit = batchSize + bias;
+    const Lab_t* treeLeafVals = treeLeaves(treeNum);
+    Lab_t curLeaves[leafChunk];
+    for (size_t from = bias; from < upperLimit; from += leafChunk) {
+        const size_t cnt = std::min(leafChunk, upperLimit - from);
+        // leaves of the samples [from; from + cnt)
+        std::fill(curLeaves, curLeaves + cnt, Lab_t(0));
+        const In_t* chunk = xPred.data() + ptrdiff_t(from) * xPred.rowStride();
+        // the scattered unknown leaves are walked one by one (slower
+        // than the kernels), so most of the leaves must be known
+        size_t knownCnt = 0;
+        if (knownLeaves != nullptr)
+            for (size_t j = 0; j < cnt; ++j)
+                knownCnt += size_t(knownLeaves[from + j] != unknownLeaf);
+        if (knownCnt * minKnownDen < cnt * minKnownNum) {
+            addTrees(treeNum, treeNum + 1, chunk, xPred.rowStride(),
+                xPred.colStride(), 0, cnt, curLeaves);
+        } else {
+            // walk the tree only for the unknown leaves:
+            // the long runs by the kernel, the short ones one by one
+            const uint32_t* chunkLeaves = knownLeaves + from;
+            const FIdx_t* curFeatures = treeFeatures(treeNum);
+            const FVal_t* curThresholds = treeThresholds(treeNum);
+            size_t j = 0;
+            while (j < cnt) {
+                if (chunkLeaves[j] != unknownLeaf) {
+                    curLeaves[j] = treeLeafVals[chunkLeaves[j]];
+                    ++j;
+                    continue;
+                }
+                size_t runEnd = j + 1;
+                while (runEnd < cnt && chunkLeaves[runEnd] == unknownLeaf)
+                    ++runEnd;
+                if (runEnd - j >= minKernelRun) {
+                    addTrees(treeNum, treeNum + 1, chunk, xPred.rowStride(),
+                        xPred.colStride(), j, runEnd, curLeaves);
+                    j = runEnd;
+                    continue;
+                }
+                for (; j < runEnd; ++j) {
+                    const In_t* row = chunk + ptrdiff_t(j) * xPred.rowStride();
+                    curLeaves[j] = treeLeafVals[findLeaf([&](const FIdx_t f) {
+                        return FVal_t(row[ptrdiff_t(f) * xPred.colStride()]);
+                    }, curFeatures, curThresholds)];
+                }
             }
-            answers(j) = curLeaves[curNode - innerNodes];
-            // remember to set curNode to 0 before the next step
-            curNode = 0;
         }
-        // thread is finishing, release "semaphore"
-        semThreadsFinish -= 1;
-    };
+        for (size_t j = 0; j < cnt; ++j) {
+            preds[from + j] += curLeaves[j];
+            residuals[from + j] -= curLeaves[j];
+        }
+    }
 }
 
 
-std::function<void()> TreeHolder::getCallbackAll(const size_t bias,
-        const size_t batchSize, const size_t treeNum,
-        const pytensor2& xPred, size_t& semThreadsFinish,
-        pytensorY& answers) const {
-    // ignore treeNum
-    // pass by values
-    const size_t treeDepth = this->treeDepth;
-    const size_t innerNodes = this->innerNodes;
-    const std::vector<std::vector<size_t>>& features = this->features;
-    const std::vector<std::vector<FVal_t>>& thresholds = this->thresholds;
-    const std::vector<std::vector<Lab_t>>& leaves = this->leaves;
-    const size_t treeCnt = this->treeCnt;
-    // don't pass 'this' by reference, don't pass 'this' at all
-    // this is needed to avoid data races
-    return [treeDepth, innerNodes, bias, batchSize, treeCnt,
-        &xPred, &semThreadsFinish, &answers, &features,
-        &thresholds, &leaves]() mutable {
-        // compute the end of the batch
-        const size_t upperLimit = batchSize + bias;
-        size_t curNode = 0; // current node in the decision tree
-        for (size_t tr = 0; tr < treeCnt; ++tr) {
-            // predict for all trees
-            // get refs for faster access
-            const std::vector<size_t>& curFeatures = features[tr];
-            const std::vector<FVal_t>& curThresholds = thresholds[tr];
-            const std::vector<Lab_t>& curLeaves = leaves[tr];
-            // predict for all batch members
-            for (size_t j = bias; j < upperLimit; ++j) {
-                // decision tree traverse
-                for (size_t h = 0; h < treeDepth; ++h) {
-                    if (xPred(j, curFeatures[h]) < curThresholds[curNode])
-                        curNode = 2 * curNode + 1;
-                    else
-                        curNode = 2 * curNode + 2;
-                }
-                answers(j) += curLeaves[curNode - innerNodes];
-                // remember to set curNode to 0 before the next step
-                curNode = 0;
-            }
+template <class In_t>
+void TreeHolder::predictBatchAll(const size_t bias, const size_t batchSize,
+    const MatrixView<const In_t>& xPred, Lab_t* answers) const {
+    if (jit != nullptr) {
+        // the compiled code makes its own tiles
+        jit->addBatch(xPred.data(), xPred.rowStride(), xPred.colStride(),
+            bias, bias + batchSize, answers);
+        return;
+    }
+    const size_t upperLimit = bias + batchSize;
+    const size_t curRowBlock = getRowBlock<In_t>();
+    const size_t curTreeBlock = getTreeBlock();
+    // traverse tiles of samples x trees, so both stay in cache;
+    // trees are still added to each answer in order
+    for (size_t rowFrom = bias; rowFrom < upperLimit; rowFrom += curRowBlock) {
+        const size_t rowTo = std::min(upperLimit, rowFrom + curRowBlock);
+        for (size_t treeFrom = 0; treeFrom < treeCnt; treeFrom += curTreeBlock) {
+            const size_t treeTo = std::min(treeCnt, treeFrom + curTreeBlock);
+            addTrees(treeFrom, treeTo, xPred.data(), xPred.rowStride(),
+                xPred.colStride(), rowFrom, rowTo, answers);
         }
-        // thread is finishing, release "semaphore"
-        semThreadsFinish -= 1;
-    };
+    }
 }
+
+
+// the sample types
+template void TreeHolder::predictTreeFit<double>(
+    const MatrixView<const double>& xTrain,
+    const MatrixView<const double>& xValid, const size_t treeNum,
+    Labels& residuals, Labels& preds, Labels& validRes,
+    Labels& validPreds, const uint32_t* trainLeaves) const;
+template void TreeHolder::predictTreeFit<float>(
+    const MatrixView<const float>& xTrain,
+    const MatrixView<const float>& xValid, const size_t treeNum,
+    Labels& residuals, Labels& preds, Labels& validRes,
+    Labels& validPreds, const uint32_t* trainLeaves) const;
+template Lab_t TreeHolder::predictTree<double>(
+    const VectorView<const double>& sample, const size_t treeNum) const;
+template Lab_t TreeHolder::predictTree<float>(
+    const VectorView<const float>& sample, const size_t treeNum) const;
+template Lab_t TreeHolder::predictAllTrees<double>(
+    const VectorView<const double>& sample) const;
+template Lab_t TreeHolder::predictAllTrees<float>(
+    const VectorView<const float>& sample) const;
+template void TreeHolder::predictAllTrees2d<double>(
+    const MatrixView<const double>& sample, Lab_t* answers) const;
+template void TreeHolder::predictAllTrees2d<float>(
+    const MatrixView<const float>& sample, Lab_t* answers) const;
+template Lab_t TreeHolder::predictFromTo<double>(
+    const VectorView<const double>& sample, const size_t from,
+    const size_t to) const;
+template Lab_t TreeHolder::predictFromTo<float>(
+    const VectorView<const float>& sample, const size_t from,
+    const size_t to) const;
@@ -1,9 +1,19 @@
 #ifndef TREE_HOLDER_INCLUDED
 #define TREE_HOLDER_INCLUDED
 
-#include "../common/Structs.h"
+#include "Structs.h"
+#include "AlignedAllocator.h"
+#include "BinaryModel.h"
+#include "JitEnsemble.h"
+#include "MappedFile.h"
+#include "ModelWriter.h"
+#include "NativeEnsemble.h"
+#include "PredictKernels.h"
+#include "ThreadPool.h"
 #include <cstddef>
-#include <functional>
+#include <cstdint>
+#include <memory>
+#include <ostream>
 #include <string>
 #include <vector>
 
@@ -11,7 +21,7 @@
 class TreeHolder {
 public:
     TreeHolder(const size_t treeDepth, const size_t featureCnt,
-        const size_t threadCnt);
+        std::shared_ptr<ThreadPool> threadPool);
     virtual ~TreeHolder();
 
     void newTree(const std::vector<size_t>& features,
@@ -20,68 +30,153 @@ public:
     void popTree();
     size_t getTreeCount() const;
 
-    Lab_t predictTree(const pytensor1& sample, const size_t treeNum) const;
-    void predictTreeFit(const pytensor2& xTrain, const pytensor2& xValid,
-        const size_t treeNum, pytensorY& residuals, pytensorY& preds,
-        pytensorY& validRes, pytensorY& validPreds) const;
-    Lab_t predictAllTrees(const pytensor1& sample) const;
-    pytensorY predictAllTrees2d(const pytensor2& sample) const;
-    Lab_t predictFromTo(const pytensor1& sample, const size_t from,
-        const size_t to) const;
-
-    pytensorY predictTree2d(const pytensor2& xPred, const size_t treeNum) const;
-    std::string serialize(const char delimeter, const Lab_t zeroPredictor) const;
+    // In_t is the type of the samples: FVal_t or float
+    template <class In_t>
+    Lab_t predictTree(const VectorView<const In_t>& sample,
+        const size_t treeNum) const;
+    // trainLeaves (if not null) are the known leaves of the train rows
+    // (unknownLeaf for the rows to walk the tree)
+    template <class In_t>
+    void predictTreeFit(const MatrixView<const In_t>& xTrain,
+        const MatrixView<const In_t>& xValid,
+        const size_t treeNum, Labels& residuals, Labels& preds,
+        Labels& validRes, Labels& validPreds,
+        const uint32_t* trainLeaves = nullptr) const;
+    template <class In_t>
+    Lab_t predictAllTrees(const VectorView<const In_t>& sample) const;
+    // answers must have sample.shape(0) items
+    template <class In_t>
+    void predictAllTrees2d(const MatrixView<const In_t>& sample,
+        Lab_t* answers) const;
+    template <class In_t>
+    Lab_t predictFromTo(const VectorView<const In_t>& sample,
+        const size_t from, const size_t to) const;
+
+    Labels predictTree2d(const FMatrix& xPred, const size_t treeNum) const;
+    // write trees to the text model file
+    void serialize(ModelWriter& out, const char delimeter,
+        const Lab_t zeroPredictor) const;
+
+    // tiles for predictAllTrees2d: rowBlock samples x treeBlock trees
+    // 0 means the size is chosen from the cache sizes
+    void setPredictBlocks(const size_t rowBlock, const size_t treeBlock);
+
+    static constexpr uint32_t unknownLeaf = UINT32_MAX; // see predictTreeFit
+    // predict all trees by the natively compiled ensemble
+    // (see JitEnsemble), adding or removing trees drops it
+    void compileJit(const std::string& cacheDir);
+    // predict the single samples by the machine code emitted in memory
+    // (see NativeEnsemble), false if it's not possible;
+    // adding or removing trees drops it
+    bool emitNative();
 
     // parse holder from file
-    static TreeHolder* parse(const char* repr,
-        const std::vector<size_t> delimPos,
+    static TreeHolder* parse(const char* repr, const char* reprEnd,
+        const std::vector<size_t>& delimPos,
         const size_t delimStart, const size_t featureCnt,
         const size_t treeCnt, const size_t treeDepth,
-        const size_t threadCnt);
+        std::shared_ptr<ThreadPool> threadPool);
+
+    // write trees in the binary format, header must contain the fields
+    // not related to the trees (magic, type, feature count, etc.)
+    void writeBinary(std::ostream& out, BinaryModelHeader header) const;
+    // use trees right from the mapped binary file (no copies),
+    // such holder is read-only (newTree & popTree throw)
+    static TreeHolder* fromMapped(std::shared_ptr<MappedFile> file,
+        const BinaryModelHeader& header,
+        std::shared_ptr<ThreadPool> threadPool);
 private:
     // fields
     const size_t treeDepth;
     const size_t innerNodes;
     const size_t featureCnt;
     const size_t leafCnt;
-    const size_t threadCnt;
+    std::shared_ptr<ThreadPool> threadPool;
+    const PredictKernels::Isa isa; // kernels for predictAllTrees2d
+    // kernels for the depth of the trees (chosen once)
+    const PredictKernels::AddTrees_t<double> kernel64;
+    const PredictKernels::AddTrees_t<float> kernel32;
+    size_t rowBlock; // 0 for auto
+    size_t treeBlock; // 0 for auto
     size_t treeCnt;
 
-    std::vector<std::vector<size_t>> features;
-    std::vector<std::vector<FVal_t>> thresholds;
-    std::vector<std::vector<Lab_t>> leaves;
+    // all trees are packed one after another:
+    // tree i has treeDepth features starting from features[i * treeDepth],
+    // innerNodes thresholds starting from thresholds[i * innerNodes]
+    // and leafCnt leaves starting from leaves[i * leafCnt]
+    AlignedVector<FIdx_t> features;
+    AlignedVector<FVal_t> thresholds;
+    AlignedVector<Lab_t> leaves;
+    // the arrays above or the arrays in the mapped file
+    std::shared_ptr<MappedFile> mappedFile; // nullptr if not mapped
+    const FIdx_t* featuresView;
+    const FVal_t* thresholdsView;
+    const Lab_t* leavesView;
+    std::shared_ptr<const JitEnsemble> jit; // nullptr if not compiled
+    std::shared_ptr<const NativeEnsemble> native; // nullptr if not emitted
 
     // methods
-    inline void validateFeatures();
+    inline void validateFeatures(const size_t treeNum);
     inline void validateTreeNum(const size_t treeNum) const;
-
-    pytensorY predictTree2dMutlithreaded(const pytensor2& xPred,
-        const size_t treeNum) const;
-
-    pytensorY predictTree2dSingleThread(const pytensor2& xPred,
-        const size_t treeNum) const;
-
-    inline void predictFitMultithreaded(const pytensor2& xTrain, const pytensor2& xValid,
-        const size_t treeNum, pytensorY& residuals, pytensorY& preds,
-        pytensorY& validRes, pytensorY& validPreds) const;
-
-    pytensorY allTrees2dMultithreaded(const pytensor2& xPred) const;
-
-    pytensorY predict2dProxy(const pytensor2& xPred,
-        const bool allTrees, const size_t treeNum) const;
-
-    std::function<void()> getCallback(const size_t bias,
-        const size_t batchSize, const size_t treeNum,
-        const pytensor2& xPred, size_t& semThreadsFinish,
-        pytensorY& answers) const;
-
-    std::function<void()> getCallbackAll(const size_t bias,
-        const size_t batchSize, const size_t treeNum,
-        const pytensor2& xPred, size_t& semThreadsFinish,
-        pytensorY& answers) const;
+    inline void validateWritable() const;
+    inline void updateViews();
+    inline const FIdx_t* treeFeatures(const size_t treeNum) const;
+    inline const FVal_t* treeThresholds(const size_t treeNum) const;
+    inline const Lab_t* treeLeaves(const size_t treeNum) const;
+    template <class In_t>
+    inline size_t getRowBlock() const; // for the samples of In_t
+    inline size_t getTreeBlock() const;
+
+    template <class In_t>
+    inline PredictKernels::AddTrees_t<In_t> getKernel() const;
+    // out[i] += predictions of trees [treeFrom; treeTo)
+    // for rows [rowFrom; rowTo) by the kernel for the depth
+    template <class In_t>
+    void addTrees(const size_t treeFrom, const size_t treeTo,
+        const In_t* x, const ptrdiff_t rowStride, const ptrdiff_t colStride,
+        const size_t rowFrom, const size_t rowTo, Lab_t* out) const;
+
+    // branchless walk of one oblivious tree, returns the leaf index
+    // value(f) must return the sample's value of the feature f
+    template <class Value_t>
+    size_t findLeaf(const Value_t& value, const FIdx_t* curFeatures,
+        const FVal_t* curThresholds) const;
+
+    // split [0; sampleCnt) into batches and process them in the pool
+    // batch(bias, batchSize) is called for each batch
+    template <class Batch_t>
+    void forEachBatch(const size_t sampleCnt, const Batch_t& batch) const;
+
+    // predictions of one tree for [bias; bias + batchSize)
+    template <class In_t>
+    void predictBatch(const size_t bias, const size_t batchSize,
+        const size_t treeNum, const MatrixView<const In_t>& xPred,
+        Lab_t* answers) const;
+
+    // add predictions of one tree for [bias; bias + batchSize)
+    // to preds and subtract them from residuals,
+    // the tree is walked only for the samples with unknown leaves
+    template <class In_t>
+    void predictBatch(const size_t bias, const size_t batchSize,
+        const size_t treeNum, const MatrixView<const In_t>& xPred,
+        Lab_t* residuals, Lab_t* preds, const uint32_t* knownLeaves) const;
+
+    // predictions of all trees for [bias; bias + batchSize)
+    template <class In_t>
+    void predictBatchAll(const size_t bias, const size_t batchSize,
+        const MatrixView<const In_t>& xPred, Lab_t* answers) const;
 
     // constants
-    static const int busyWaitMs = 1;
+    static constexpr size_t minBatchSize = 64; // don't split small batches
+    static constexpr size_t rowBlockBytes = 16 * 1024; // samples of a tile (L1)
+    static constexpr size_t treeBlockBytes = 128 * 1024; // trees of a tile (L2)
+    static constexpr size_t rowBlockMin = 16;
+    static constexpr size_t rowBlockMax = 1024;
+    static constexpr size_t leafChunk = 256; // leaves of one tree on the stack
+    static constexpr size_t minKernelRun = 16; // shorter runs skip the kernels
+    // the known leaves of a chunk are used if they are >= 2/3 of it
+    static constexpr size_t minKnownNum = 2;
+    static constexpr size_t minKnownDen = 3;
 };
 
 #endif // TREE_HOLDER_INCLUDED
\ No newline at end of file
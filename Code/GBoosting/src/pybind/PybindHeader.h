@@ -0,0 +1,47 @@
+#ifndef PYBIND_HEADER_H_INCLUDED
+#define PYBIND_HEADER_H_INCLUDED
+
+#include "pybind11/pybind11.h"
+
+#include "xtensor/xmath.hpp"
+#include "xtensor/xarray.hpp"
+#include "xtensor/xview.hpp"
+
+#include "xtensor-python/pytensor.hpp"
+
+#include "../common/Structs.h"
+#include <algorithm>
+
+// inputs have dynamic layout, so C-ordered, F-ordered and sliced
+// arrays are used as is (no copies)
+template <class T, size_t N>
+using pytensorIn = xt::pytensor<T, N, xt::layout_type::dynamic>;
+using pytensor1 = pytensorIn<FVal_t, 1>;
+using pytensor2 = pytensorIn<FVal_t, 2>;
+// float32 samples for prediction
+using pytensor1f = pytensorIn<float, 1>;
+using pytensor2f = pytensorIn<float, 2>;
+using pytensorY = xt::pytensor<Lab_t, 1>;
+
+// the core library works with views of numpy arrays (no copies)
+template <class T, xt::layout_type L>
+inline MatrixView<const T> matrixView(const xt::pytensor<T, 2, L>& x) {
+    const auto xStrides = x.strides();
+    return MatrixView<const T>(x.data(), x.shape(0), x.shape(1),
+        ptrdiff_t(xStrides[0]), ptrdiff_t(xStrides[1]));
+}
+
+
+template <class T, xt::layout_type L>
+inline VectorView<const T> vectorView(const xt::pytensor<T, 1, L>& x) {
+    return VectorView<const T>(x.data(), x.shape(0), ptrdiff_t(x.strides()[0]));
+}
+
+
+inline pytensorY toPytensor(const Labels& vals) {
+    pytensorY ans = pytensorY::from_shape({vals.size()});
+    std::copy(vals.begin(), vals.end(), ans.data());
+    return ans;
+}
+
+#endif // PYBIND_HEADER_H_INCLUDED
@@ -12,6 +12,7 @@ namespace defaultParams {
     const float batchPart = 1.0f;
     const unsigned int randomState = 12;
     const bool randomBatches = false;
+    const bool bootstrap = false; // random batches without replacement
     const Lab_t regParam = 0; // no regularization
     const bool noEs = false; // use early stopping by default
     const float featureFoldSize = 1.0f; // use all features
@@ -19,4 +20,9 @@ namespace defaultParams {
     const bool removeReg = false;
     const size_t threadCnt = 1;
     const bool spoilScores = true;
+    const size_t predictRowBlock = 0; // choose automatically
+    const size_t predictTreeBlock = 0; // choose automatically
+    const bool binaryModel = false; // save models as text
+    const bool quantileBins = false; // uniform bins
+    const char* const jitCacheDir = ""; // $REGBM_JIT_CACHE or ~/.cache/regbm_jit
 };
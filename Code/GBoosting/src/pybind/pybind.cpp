@@ -3,8 +3,7 @@
 #define FORCE_IMPORT_ARRAY
 #include "xtensor-python/pyarray.hpp"
 
-#include "xtensor/xmath.hpp"
-#include "xtensor/xarray.hpp"
+#include "PybindHeader.h"
 
 #include "../common/History.h"
 #include "../common/GBoosting.h"
@@ -15,6 +14,31 @@ namespace py = pybind11;
 namespace dp = defaultParams;
 
 
+// train on float64 or float32 samples (In_t), the arrays aren't copied
+template <class In_t>
+History fitModel(GradientBoosting& self, const pytensorIn<In_t, 2>& xTrain,
+    const pytensorY& yTrain, const pytensorIn<In_t, 2>& xValid,
+    const pytensorY& yValid, const size_t treeCount,
+    const size_t treeDepth, const float featureSubsetPart,
+    const float learningRate, const Lab_t regularizationParam,
+    const Lab_t earlyStoppingDelta, const float batchPart,
+    const unsigned int randomState, const bool randomBatches,
+    const bool randomThresholds, const bool removeRegularizationLater,
+    const bool spoilScores, const bool bootstrap) {
+    const MatrixView<const In_t> xTrainView = matrixView(xTrain);
+    const LVector yTrainView = vectorView(yTrain);
+    const MatrixView<const In_t> xValidView = matrixView(xValid);
+    const LVector yValidView = vectorView(yValid);
+    // the arrays are kept alive by the caller, train without the GIL
+    py::gil_scoped_release release;
+    return self.fit(xTrainView, yTrainView, xValidView, yValidView,
+        treeCount, treeDepth, featureSubsetPart, learningRate,
+        regularizationParam, earlyStoppingDelta, batchPart,
+        randomState, randomBatches, randomThresholds,
+        removeRegularizationLater, spoilScores, bootstrap);
+}
+
+
 PYBIND11_MODULE(regbm, m) {
     xt::import_numpy();
     
@@ -23,25 +47,30 @@ PYBIND11_MODULE(regbm, m) {
     py::class_<History>(m, "History")
         .def("trees_number", &History::getTreesLearnt,
         "Get the number of trees built during fit")
-        .def("train_losses", &History::getTrainLosses,
+        .def("train_losses", [](const History& self) {
+            return toPytensor(self.getTrainLosses());
+        },
         "Get train losses array")
-        .def("valid_losses", &History::getValidLosses,
+        .def("valid_losses", [](const History& self) {
+            return toPytensor(self.getValidLosses());
+        },
         "Get validation losses array");
     
     py::class_<GradientBoosting>(m, "Boosting")
         .def(py::init<const size_t, const size_t, const size_t,
-             const bool, const size_t>(), 
+             const bool, const size_t, const bool>(), 
             "Gradient boosting model constructor",
             py::arg("min_bins")=dp::binsMin, 
             py::arg("max_bins")=dp::binsMax,
             py::arg("patience")=dp::patience,
             py::arg("no_early_stopping")=dp::noEs,
-            py::arg("thread_cnt")=dp::threadCnt)
+            py::arg("thread_cnt")=dp::threadCnt,
+            py::arg("quantile_bins")=dp::quantileBins)
         .def(py::init<const std::string&, const size_t>(),
             "Load GB model from the file",
             py::arg("filename"),
             py::arg("thread_cnt")=dp::threadCnt)
-        .def("fit", &GradientBoosting::fit, "Fit regression model", py::arg("x_train"),
+        .def("fit", &fitModel<FVal_t>, "Fit regression model", py::arg("x_train"),
             py::arg("y_train"), py::arg("x_valid"), py::arg("y_valid"),
             py::arg("tree_count")=dp::treeCount, 
             py::arg("tree_depth")=dp::treeDepth,
@@ -54,13 +83,87 @@ PYBIND11_MODULE(regbm, m) {
             py::arg("random_batches")=dp::randomBatches,
             py::arg("random_hist_thresholds")=dp::randThresholds,
             py::arg("remove_regularization_later")=dp::removeReg,
-            py::arg("spoil_split_scores")=dp::spoilScores)
-        .def("predict", static_cast<Lab_t (GradientBoosting::*)(const pytensor1&)const>(&GradientBoosting::predict), "Predict labels for a single sample",
+            py::arg("spoil_split_scores")=dp::spoilScores,
+            py::arg("bootstrap")=dp::bootstrap)
+        // float32 mode: chosen when both x_train & x_valid are float32
+        .def("fit", &fitModel<float>, "Fit regression model on float32 samples",
+            py::arg("x_train").noconvert(),
+            py::arg("y_train"), py::arg("x_valid").noconvert(), py::arg("y_valid"),
+            py::arg("tree_count")=dp::treeCount, 
+            py::arg("tree_depth")=dp::treeDepth,
+            py::arg("feature_fold_size")=dp::featureFoldSize,
+            py::arg("learning_rate")=dp::learningRate,
+            py::arg("regularization_param")=dp::regParam,
+            py::arg("early_stopping_delta")=dp::earlyStoppingDelta,
+            py::arg("batch_part")=dp::batchPart,
+            py::arg("random_state")=dp::randomState,
+            py::arg("random_batches")=dp::randomBatches,
+            py::arg("random_hist_thresholds")=dp::randThresholds,
+            py::arg("remove_regularization_later")=dp::removeReg,
+            py::arg("spoil_split_scores")=dp::spoilScores,
+            py::arg("bootstrap")=dp::bootstrap)
+        .def("predict", [](const GradientBoosting& self, const pytensor1& xTest) {
+            const FVector xTestView = vectorView(xTest);
+            py::gil_scoped_release release;
+            return self.predict(xTestView);
+        }, "Predict labels for a single sample",
             py::arg("x_test"))
-        .def("predict", static_cast<pytensorY (GradientBoosting::*)(const pytensor2&)const>(&GradientBoosting::predict), "Predict labels for batch",
+        .def("predict", [](const GradientBoosting& self, const pytensor2& xTest) {
+            // predictions are written right to the numpy array
+            pytensorY answers = pytensorY::from_shape({xTest.shape(0)});
+            const FMatrix xTestView = matrixView(xTest);
+            Lab_t* answersData = answers.data();
+            {
+                // other Python threads may run (or predict) meanwhile
+                py::gil_scoped_release release;
+                self.predict(xTestView, answersData);
+            }
+            return answers;
+        }, "Predict labels for batch",
             py::arg("x_test"))
-        .def("predict_from_to", &GradientBoosting::predictFromTo, "Predict labels for sample on a subset of trees",
+        // float32 samples are used without conversion; float64 ones
+        // don't match these overloads (noconvert) & go to the ones above
+        .def("predict", [](const GradientBoosting& self, const pytensor1f& xTest) {
+            const VectorView<const float> xTestView = vectorView(xTest);
+            py::gil_scoped_release release;
+            return self.predict(xTestView);
+        }, "Predict labels for a single float32 sample",
+            py::arg("x_test").noconvert())
+        .def("predict", [](const GradientBoosting& self, const pytensor2f& xTest) {
+            pytensorY answers = pytensorY::from_shape({xTest.shape(0)});
+            const MatrixView<const float> xTestView = matrixView(xTest);
+            Lab_t* answersData = answers.data();
+            {
+                py::gil_scoped_release release;
+                self.predict(xTestView, answersData);
+            }
+            return answers;
+        }, "Predict labels for float32 batch",
+            py::arg("x_test").noconvert())
+        .def("predict_from_to", [](const GradientBoosting& self,
+            const pytensor1& xTest, const size_t from, const size_t to) {
+            const FVector xTestView = vectorView(xTest);
+            py::gil_scoped_release release;
+            return self.predictFromTo(xTestView, from, to);
+        }, "Predict labels for sample on a subset of trees",
             py::arg("x_test"), py::arg("from"), py::arg("to"))
-        .def("save_model", static_cast<void (GradientBoosting::*)(const std::string&)const>(&GradientBoosting::saveModel), "Save GB model to the file",
-            py::arg("filename"));
+        .def("predict_from_to", [](const GradientBoosting& self,
+            const pytensor1f& xTest, const size_t from, const size_t to) {
+            const VectorView<const float> xTestView = vectorView(xTest);
+            py::gil_scoped_release release;
+            return self.predictFromTo(xTestView, from, to);
+        }, "Predict labels for float32 sample on a subset of trees",
+            py::arg("x_test").noconvert(), py::arg("from"), py::arg("to"))
+        .def("save_model", &GradientBoosting::saveModel, "Save GB model to the file (binary models are mapped on load)",
+            py::arg("filename"), py::arg("binary")=dp::binaryModel,
+            py::call_guard<py::gil_scoped_release>())
+        .def("set_predict_blocks", &GradientBoosting::setPredictBlocks,
+            "Set tile sizes (samples x trees) for batch prediction, 0 for auto",
+            py::call_guard<py::gil_scoped_release>(),
+            py::arg("row_block")=dp::predictRowBlock,
+            py::arg("tree_block")=dp::predictTreeBlock)
+        .def("compile_jit", &GradientBoosting::compileJit,
+            "Compile the trees to native code for predict (cached on disk by the model hash)",
+            py::call_guard<py::gil_scoped_release>(),
+            py::arg("cache_dir")=dp::jitCacheDir);
 }
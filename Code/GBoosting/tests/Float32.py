@@ -0,0 +1,37 @@
+import numpy as np
+import time
+
+from testHelpers import make_data, fit_model, score, check
+
+
+# float32 fit may lose accuracy only because of the rounded samples
+MAE_TOLERANCE = 0.02
+
+
+def main():
+    x_tr, x_test, y_tr, y_test = make_data(200000)
+    model_args = dict(min_bins=64, max_bins=256)
+    # float64 (default) mode
+    model64, fit64 = fit_model(x_tr, y_tr, x_test, y_test, model_args)
+    mae64 = score(model64, x_test, y_test)
+    print(f"float64: MAE {mae64}, fit {fit64} s")
+    # float32 mode is chosen by the type of the samples
+    x_tr32 = x_tr.astype(np.float32)
+    x_test32 = x_test.astype(np.float32)
+    model32, fit32 = fit_model(x_tr32, y_tr, x_test32, y_test, model_args)
+    start_time = time.time()
+    preds32 = model32.predict(x_test32)
+    predict32 = time.time() - start_time
+    mae32 = score(model32, x_test32, y_test)
+    print(f"float32: MAE {mae32}, fit {fit32} s, predict {predict32} s")
+    print(f"MAE relative change: {(mae32 - mae64) / mae64}")
+    check(abs(mae32 - mae64) <= MAE_TOLERANCE * mae64,
+        "float32 MAE within the tolerance")
+    # the float32 samples are compared as doubles (no extra rounding)
+    check(np.array_equal(preds32, model32.predict(x_test32.astype(np.float64))),
+        "float32 predict == float64 predict of the same samples")
+    print("Finish")
+
+
+if __name__ == "__main__":
+    main()
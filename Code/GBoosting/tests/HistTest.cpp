@@ -0,0 +1,162 @@
+// The histograms must score the splits as they are performed:
+// the samples of the bins [0; bin] go left, the others go right
+// (NaN has the last bin); the model learns the NaN samples as a group;
+// the labels far from 0 are scored as precisely as the small ones
+#include "GBHist.h"
+#include "GBoosting.h"
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <limits>
+#include <random>
+#include <vector>
+
+
+namespace {
+
+const Lab_t nanLabel = 10;
+
+
+// the left part of each split is the bins [0; bin]
+bool checkSplits(const GBHist& hist, const FeatureBins& bins,
+    const MatrixView<const double>& x, const LVector& y) {
+    const size_t n = x.shape(0);
+    const size_t binCount = hist.getBinCount();
+    const uint8_t* column = bins.column<uint8_t>(0);
+    for (size_t i = 0; i < n; ++i) {
+        if (std::isnan(x(i, 0)) && column[i] != binCount - 1) {
+            std::printf("NaN sample %zu is in the bin %d\n", i, int(column[i]));
+            return false;
+        }
+    }
+    std::vector<size_t> all(n);
+    for (size_t i = 0; i < n; ++i)
+        all[i] = i;
+    std::vector<BinStats> stats(binCount);
+    hist.buildHist(bins, 0, all.data(), n, y, 0, stats.data());
+    std::vector<size_t> subset(n), buffer(n);
+    std::mt19937_64 generator(12); // the thresholds aren't random here
+    size_t leftExpected = 0;
+    for (size_t bin = 0; bin + 1 < binCount; ++bin) {
+        leftExpected += stats[bin].size;
+        subset = all;
+        const size_t leftSize = hist.performSplit(x, 0, subset.data(), n,
+            hist.getThreshold(bin, generator), buffer.data());
+        if (leftSize != leftExpected) {
+            std::printf("bin %zu of %zu: %zu samples go left, %zu are scored\n",
+                bin, binCount, leftSize, leftExpected);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool testSplits(const MatrixView<const double>& x, const LVector& y) {
+    // the net grows from 8 to 64 bins, the bins are refined
+    GBHist hist(8, 64, 10, x.col(0), 0, false);
+    FeatureBins bins(x.shape(0), 1, 64);
+    hist.binarize(x, 0, bins);
+    bool passed = checkSplits(hist, bins, x, y);
+    for (size_t iter = 0; iter < 10 && passed; ++iter) {
+        if (hist.updateNet()) {
+            hist.refineBins(x, 0, bins);
+            passed = checkSplits(hist, bins, x, y);
+        }
+    }
+    return passed;
+}
+
+
+bool testFit(const MatrixView<const double>& x, const LVector& y) {
+    GradientBoosting model(64, 64, 3, true, 1);
+    model.fit(x, y, x, y, 30, 3, 1.0f, 0.5f, 0, 0, 1.0f, 12, false, false,
+        false, false, false);
+    const Labels preds = model.predict(x);
+    Lab_t maxError = 0;
+    for (size_t i = 0; i < x.shape(0); ++i) {
+        if (std::isnan(x(i, 0)))
+            maxError = std::max(maxError, std::fabs(preds[i] - nanLabel));
+    }
+    if (maxError > 0.1) {
+        std::printf("NaN samples are predicted with the error %g\n", maxError);
+        return false;
+    }
+    // the infinite threshold (all values | NaN) is saved & parsed back
+    const std::string fname = (std::filesystem::temp_directory_path() /
+        "regbm_hist_test.txt").string();
+    model.saveModel(fname);
+    const Labels loaded = GradientBoosting(fname, 1).predict(x);
+    std::filesystem::remove(fname);
+    if (loaded != preds) {
+        std::printf("The loaded model predicts other values\n");
+        return false;
+    }
+    return true;
+}
+
+
+// labels: offset * x0 + a small signal of x1 (x0 is 0 or 1), the first
+// tree splits x0, the deeper nodes see the labels around +-offset
+Lab_t offsetFitMse(const Lab_t offset) {
+    std::mt19937_64 gen(12);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    const size_t n = 4000;
+    std::vector<double> x(2 * n);
+    std::vector<Lab_t> y(n);
+    for (size_t i = 0; i < n; ++i) {
+        x[2 * i] = double(gen() % 2);
+        x[2 * i + 1] = uniform(gen);
+        y[i] = offset * x[2 * i] + 1e-2 * std::sin(3 * x[2 * i + 1]);
+    }
+    const MatrixView<const double> xView(x.data(), n, 2);
+    const LVector yView(y.data(), n);
+    GradientBoosting model(64, 64, 3, true, 1);
+    model.fit(xView, yView, xView, yView, 10, 4, 1.0f, 1.0f, 0, 0, 1.0f, 12,
+        false, false, false, false, false);
+    const Labels preds = model.predict(xView);
+    Lab_t mse = 0;
+    for (size_t i = 0; i < n; ++i)
+        mse += (preds[i] - y[i]) * (preds[i] - y[i]);
+    return mse / n;
+}
+
+
+// the split scores don't depend on the offset of the labels (the
+// histograms are built around the node means), so the fit is as good
+bool testLargeLabels() {
+    const Lab_t smallMse = offsetFitMse(10);
+    for (const Lab_t offset : {1e6, 1e8}) {
+        const Lab_t mse = offsetFitMse(offset);
+        if (mse > 1.5 * smallMse) {
+            std::printf("labels offset %g: MSE %g, %g for offset 10\n",
+                offset, mse, smallMse);
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+
+int main() {
+    std::mt19937_64 gen(12);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    const size_t n = 2000;
+    std::vector<double> x(n);
+    std::vector<Lab_t> y(n);
+    for (size_t i = 0; i < n; ++i) {
+        // every 5th sample is NaN (the first one too: min & max skip it)
+        x[i] = (i % 5 == 0)? std::numeric_limits<double>::quiet_NaN() :
+            uniform(gen);
+        y[i] = std::isnan(x[i])? nanLabel : x[i];
+    }
+    const MatrixView<const double> xView(x.data(), n, 1);
+    const LVector yView(y.data(), n);
+    bool passed = testSplits(xView, yView);
+    passed = testFit(xView, yView) && passed;
+    passed = testLargeLabels() && passed;
+    std::printf("Test passed: %s\n", passed? "true" : "false");
+    return passed? 0 : 1;
+}
@@ -0,0 +1,78 @@
+import numpy as np
+import glob
+import shutil
+import tempfile
+import time
+import os
+
+from testHelpers import make_data, fit_model, check
+
+
+def library_files(cache_dir):
+    return sorted(glob.glob(os.path.join(cache_dir, 'regbm_jit_*')))
+
+
+def same_content(path1, path2):
+    with open(path1, 'rb') as file1, open(path2, 'rb') as file2:
+        return file1.read() == file2.read()
+
+
+def main():
+    x_tr, x_test, y_tr, y_test = make_data(100000)
+    model, _ = fit_model(x_tr, y_tr, x_test, y_test, tree_count=300)
+    start_time = time.time()
+    preds = model.predict(x_test)
+    predict_time = time.time() - start_time
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        # the first call compiles the model, the second one (as after
+        # the restart) finds it in the cache
+        cache_dir = os.path.join(tmp_dir, 'cache')
+        start_time = time.time()
+        model.compile_jit(cache_dir=cache_dir)
+        compile_time = time.time() - start_time
+        libraries = library_files(cache_dir)
+        check(len(libraries) == 1, "the compiled model is cached")
+        library = libraries[0]
+        mtime = os.stat(library).st_mtime_ns
+        # the cached library is loaded even without the compiler
+        path = os.environ.get('PATH', '')
+        os.environ['PATH'] = ''
+        try:
+            start_time = time.time()
+            model.compile_jit(cache_dir=cache_dir)
+            cached_time = time.time() - start_time
+        finally:
+            os.environ['PATH'] = path
+        print(f"compile {compile_time} s, from cache {cached_time} s")
+        check(library_files(cache_dir) == libraries and
+            os.stat(library).st_mtime_ns == mtime,
+            "the cached library is loaded without compiling")
+        start_time = time.time()
+        preds_jit = model.predict(x_test)
+        jit_time = time.time() - start_time
+        print(f"predict {predict_time} s, compiled {jit_time} s")
+        # trees are added in the same order, answers are the same
+        check(np.array_equal(preds, preds_jit) and
+            model.predict(x_test[0]) == preds[0],
+            "compiled predict == interpreted predict")
+
+        # a library of other model under the name of this model
+        # must be compiled again, not used
+        other, _ = fit_model(x_tr, y_tr, x_test, y_test, tree_count=10)
+        other_dir = os.path.join(tmp_dir, 'other')
+        other.compile_jit(cache_dir=other_dir)
+        other_library = library_files(other_dir)[0]
+        stale_dir = os.path.join(tmp_dir, 'stale')
+        os.mkdir(stale_dir, 0o700)
+        stale_library = os.path.join(stale_dir, os.path.basename(library))
+        shutil.copyfile(other_library, stale_library)
+        os.chmod(stale_library, 0o700)
+        model.compile_jit(cache_dir=stale_dir)
+        check(not same_content(stale_library, other_library) and
+            np.array_equal(model.predict(x_test), preds),
+            "the library of other model is compiled again")
+    print("Finish")
+
+
+if __name__ == "__main__":
+    main()
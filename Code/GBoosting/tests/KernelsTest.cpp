@@ -0,0 +1,110 @@
+// The prediction kernels must give the same answers bit for bit:
+// for each depth the unrolled kernel == the kernel for any depth ==
+// the trees added one by one in order, for all instruction sets
+// supported by the CPU, double & float samples, all row tails
+#include "PredictKernels.h"
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <vector>
+
+
+namespace {
+
+struct RandomForest {
+    std::vector<FIdx_t> features;
+    std::vector<FVal_t> thresholds;
+    std::vector<Lab_t> leaves;
+    PredictKernels::Forest forest;
+
+    RandomForest(const size_t treeCnt, const size_t depth,
+        const size_t featureCnt, std::mt19937_64& gen) {
+        const size_t innerNodes = (size_t(1) << depth) - 1;
+        const size_t leafCnt = size_t(1) << depth;
+        std::normal_distribution<double> normal;
+        // leaves of very different scales: the sum depends on the order
+        std::uniform_int_distribution<int> scale(-30, 30);
+        for (size_t i = 0; i < treeCnt * depth; ++i)
+            features.push_back(FIdx_t(gen() % featureCnt));
+        for (size_t i = 0; i < treeCnt * innerNodes; ++i)
+            thresholds.push_back(normal(gen));
+        for (size_t i = 0; i < treeCnt * leafCnt; ++i)
+            leaves.push_back(std::ldexp(normal(gen), scale(gen)));
+        forest = {features.data(), thresholds.data(), leaves.data(), depth};
+    }
+
+    // the trees one by one
+    template <class In_t>
+    Lab_t predict(const In_t* row, const ptrdiff_t colStride,
+        const size_t treeCnt) const {
+        const size_t depth = forest.treeDepth;
+        const size_t innerNodes = (size_t(1) << depth) - 1;
+        volatile Lab_t acc = 0; // no reassociation even with -ffast-math
+        for (size_t tr = 0; tr < treeCnt; ++tr) {
+            size_t node = 0;
+            for (size_t h = 0; h < depth; ++h) {
+                const FVal_t val = row[ptrdiff_t(features[tr * depth + h]) * colStride];
+                node = 2 * node + 2 - size_t(val < thresholds[tr * innerNodes + node]);
+            }
+            acc = acc + leaves[tr * (innerNodes + 1) + node - innerNodes];
+        }
+        return acc;
+    }
+};
+
+
+template <class In_t>
+bool testDepth(const size_t depth, const PredictKernels::Isa isa,
+    std::mt19937_64& gen) {
+    const size_t treeCnt = 67;
+    const size_t featureCnt = 7;
+    const size_t rowCnt = 45; // the tails of 4 & 8 rows
+    const RandomForest trees(treeCnt, depth, featureCnt, gen);
+    std::normal_distribution<double> normal;
+    std::vector<In_t> x(rowCnt * featureCnt);
+    for (auto& val : x)
+        val = In_t(normal(gen));
+    x[3] = std::numeric_limits<In_t>::quiet_NaN(); // NaN goes right
+    const auto unrolled = PredictKernels::getKernel<In_t>(isa, depth);
+    const auto anyDepth = PredictKernels::getKernel<In_t>(isa, 0);
+    // row major & column major samples
+    for (const bool rowMajor : {true, false}) {
+        const ptrdiff_t rowStride = rowMajor? ptrdiff_t(featureCnt) : 1;
+        const ptrdiff_t colStride = rowMajor? 1 : ptrdiff_t(rowCnt);
+        for (size_t rowFrom = 0; rowFrom < 9; ++rowFrom) {
+            std::vector<Lab_t> out1(rowCnt, 0), out2(rowCnt, 0);
+            unrolled(trees.forest, 0, treeCnt, x.data(), rowStride, colStride,
+                rowFrom, rowCnt, out1.data());
+            anyDepth(trees.forest, 0, treeCnt, x.data(), rowStride, colStride,
+                rowFrom, rowCnt, out2.data());
+            for (size_t i = rowFrom; i < rowCnt; ++i) {
+                const Lab_t expected = trees.predict(
+                    x.data() + ptrdiff_t(i) * rowStride, colStride, treeCnt);
+                if (out1[i] != expected || out2[i] != expected) {
+                    std::printf("depth %zu, isa %d, row %zu: %.17g %.17g != %.17g\n",
+                        depth, int(isa), i, out1[i], out2[i], expected);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+
+int main() {
+    std::mt19937_64 gen(12);
+    const int bestIsa = int(PredictKernels::detectIsa());
+    bool passed = true;
+    for (int isa = 0; isa <= bestIsa; ++isa) {
+        for (size_t depth = 1; depth <= PredictKernels::maxUnrolledDepth + 2; ++depth) {
+            passed = testDepth<double>(depth, PredictKernels::Isa(isa), gen) && passed;
+            passed = testDepth<float>(depth, PredictKernels::Isa(isa), gen) && passed;
+        }
+    }
+    std::printf("Test passed: %s\n", passed? "true" : "false");
+    return passed? 0 : 1;
+}
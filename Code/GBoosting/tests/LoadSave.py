@@ -3,6 +3,7 @@ from sklearn.model_selection import train_test_split
 from sklearn.datasets import make_regression
 from sklearn.metrics import mean_absolute_error as mae_score
 import os, sys
+from concurrent.futures import ThreadPoolExecutor
 
 # as the module is created in the upper directory
 sys.path.append('..')  
@@ -13,6 +14,7 @@ def main():
     rand_state = 12
     cpt_file = os.path.join('checkpoints', 'test.txt')
     cpt_file2 = os.path.join('checkpoints', 'test2.txt')
+    cpt_file_bin = os.path.join('checkpoints', 'test.bin')
     # make dataset
     x_all, y_all = make_regression(n_samples=1000, n_features=3,
         n_informative=3, n_targets=1, shuffle=True,
@@ -38,6 +40,24 @@ def main():
     mae_new = mae_score(y_test, preds)
     print(f"Saved & loaded MAE: {mae}")
     print(f"Test passed: {np.isclose(mae, mae_new)}")
+    # text models keep all digits too
+    print(f"Exact text round trip: {np.array_equal(model.predict(x_test), preds)}")
+    # binary model is used as is (no precision loss)
+    model.save_model(cpt_file_bin, binary=True)
+    loaded_bin = regbm.Boosting(filename=cpt_file_bin,
+        thread_cnt=1)
+    preds_bin = loaded_bin.predict(x_test)
+    print(f"Binary test passed: {np.array_equal(model.predict(x_test), preds_bin)}")
+    # float32 and Fortran-ordered arrays are used without copies
+    x_test32 = x_test.astype(np.float32)
+    preds32 = model.predict(x_test32)
+    preds_fortran = model.predict(np.asfortranarray(x_test32))
+    preds_ref = model.predict(x_test32.astype(np.float64))
+    print(f"Float32 test passed: {np.array_equal(preds32, preds_ref) and np.array_equal(preds_fortran, preds_ref)}")
+    # predict releases the GIL, one model can serve several threads
+    with ThreadPoolExecutor(max_workers=4) as executor:
+        all_preds = list(executor.map(loaded_bin.predict, [x_test] * 8))
+    print(f"Concurrent predict passed: {all(np.array_equal(p, preds_bin) for p in all_preds)}")
     print("Finish")
 
 
@@ -0,0 +1,34 @@
+import numpy as np
+
+from testHelpers import RAND_STATE, split, fit_model, score, check
+
+
+def fit_and_score(x_tr, y_tr, x_test, y_test, bins, quantile_bins):
+    model, fit_time = fit_model(x_tr, y_tr, x_test, y_test,
+        dict(min_bins=bins, max_bins=bins, quantile_bins=quantile_bins),
+        learning_rate=0.3)
+    mae = score(model, x_test, y_test)
+    kind = "quantile" if quantile_bins else "uniform"
+    print(f"{bins} {kind} bins: MAE {mae}, fit {fit_time} s")
+    return mae
+
+
+def main():
+    rng = np.random.default_rng(RAND_STATE)
+    # skewed features (like prices or counts): uniform bins put
+    # almost all samples to the first bins
+    x_all = rng.lognormal(mean=0.0, sigma=2.0, size=(100000, 5))
+    y_all = np.sin(np.log(x_all)).sum(axis=1) + 0.1 * rng.normal(size=x_all.shape[0])
+    x_tr, x_test, y_tr, y_test = split(x_all, y_all)
+    mae_uniform32 = fit_and_score(x_tr, y_tr, x_test, y_test, 32, False)
+    mae_uniform512 = fit_and_score(x_tr, y_tr, x_test, y_test, 512, False)
+    mae_quantile32 = fit_and_score(x_tr, y_tr, x_test, y_test, 32, True)
+    check(mae_quantile32 < mae_uniform32,
+        "32 quantile bins beat 32 uniform bins")
+    check(mae_quantile32 <= mae_uniform512,
+        "32 quantile bins are not worse than 512 uniform bins")
+    print("Finish")
+
+
+if __name__ == "__main__":
+    main()
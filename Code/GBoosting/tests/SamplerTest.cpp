@@ -0,0 +1,117 @@
+// The random batches: the rows come sorted and in range, the bagging
+// draws exactly batchSize rows (about 1 - 1/e of them are unique for
+// batchSize == rowCnt), the batch without replacement has batchSize
+// distinct rows on average; the same seed gives the same batches
+#include "BatchSampler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+
+namespace {
+
+const size_t batchCnt = 200;
+
+
+bool testBagging(const size_t rowCnt, const size_t batchSize) {
+    BatchSampler sampler(rowCnt, batchSize, true, 12);
+    std::vector<size_t> rows;
+    double uniqueSum = 0, rowSum = 0;
+    for (size_t b = 0; b < batchCnt; ++b) {
+        sampler.next(rows);
+        if (rows.size() != batchSize || !std::is_sorted(rows.begin(), rows.end()) ||
+            rows.back() >= rowCnt) {
+            std::printf("bagging %zu of %zu: %zu rows, unsorted or out of range\n",
+                batchSize, rowCnt, rows.size());
+            return false;
+        }
+        for (const size_t row : rows)
+            rowSum += double(row);
+        uniqueSum += double(std::unique(rows.begin(), rows.end()) - rows.begin());
+    }
+    // the rows are uniform: the mean row is in the middle
+    const double meanRow = rowSum / double(batchCnt * batchSize);
+    if (std::fabs(meanRow / double(rowCnt) - 0.5) > 0.02) {
+        std::printf("bagging %zu of %zu: the mean row is %g\n", batchSize,
+            rowCnt, meanRow);
+        return false;
+    }
+    if (batchSize == rowCnt) {
+        const double uniquePart = uniqueSum / double(batchCnt * batchSize);
+        if (std::fabs(uniquePart - (1 - std::exp(-1.0))) > 0.01) {
+            std::printf("bagging %zu of %zu: %g of the rows are unique\n",
+                batchSize, rowCnt, uniquePart);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool testBernoulli(const size_t rowCnt, const size_t batchSize) {
+    BatchSampler sampler(rowCnt, batchSize, false, 12);
+    std::vector<size_t> rows;
+    double sizeSum = 0;
+    for (size_t b = 0; b < batchCnt; ++b) {
+        sampler.next(rows);
+        if (rows.empty() || rows.back() >= rowCnt ||
+            std::adjacent_find(rows.begin(), rows.end(),
+                [](const size_t a, const size_t b) { return a >= b; }) != rows.end()) {
+            std::printf("batch %zu of %zu: empty, out of range or not increasing\n",
+                batchSize, rowCnt);
+            return false;
+        }
+        if (batchSize == rowCnt && rows.size() != rowCnt) {
+            std::printf("full batch of %zu: %zu rows\n", rowCnt, rows.size());
+            return false;
+        }
+        sizeSum += double(rows.size());
+    }
+    const double meanSize = sizeSum / double(batchCnt);
+    if (std::fabs(meanSize / double(batchSize) - 1) > 0.05) {
+        std::printf("batch %zu of %zu: %g rows on average\n", batchSize,
+            rowCnt, meanSize);
+        return false;
+    }
+    return true;
+}
+
+
+bool testSeed(const bool withReplacement) {
+    BatchSampler sampler1(1000, 100, withReplacement, 12);
+    BatchSampler sampler2(1000, 100, withReplacement, 12);
+    BatchSampler sampler3(1000, 100, withReplacement, 13);
+    std::vector<size_t> rows1, rows2, rows3;
+    bool differ = false;
+    for (size_t b = 0; b < 10; ++b) {
+        sampler1.next(rows1);
+        sampler2.next(rows2);
+        sampler3.next(rows3);
+        if (rows1 != rows2) {
+            std::printf("the same seed gives other batches\n");
+            return false;
+        }
+        differ = differ || rows1 != rows3;
+    }
+    if (!differ)
+        std::printf("other seed gives the same batches\n");
+    return differ;
+}
+
+} // namespace
+
+
+int main() {
+    bool passed = true;
+    for (const size_t batchSize : {100, 1000}) {
+        passed = testBagging(1000, batchSize) && passed;
+        passed = testBernoulli(1000, batchSize) && passed;
+    }
+    passed = testBagging(100000, 5000) && passed;
+    passed = testBernoulli(100000, 5000) && passed;
+    passed = testSeed(false) && passed;
+    passed = testSeed(true) && passed;
+    std::printf("Test passed: %s\n", passed? "true" : "false");
+    return passed? 0 : 1;
+}
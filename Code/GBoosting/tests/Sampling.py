@@ -0,0 +1,52 @@
+import numpy as np
+
+from testHelpers import RAND_STATE, split, fit_model, score, check
+
+
+def fit_and_predict(x_tr, y_tr, x_test, y_test, batch_part, bootstrap,
+    random_state=RAND_STATE):
+    # the random batches (random_batches=False takes them at random,
+    # not in order) are the only random part of the fit
+    model, fit_time = fit_model(x_tr, y_tr, x_test, y_test,
+        learning_rate=0.3, batch_part=batch_part, bootstrap=bootstrap,
+        random_state=random_state, random_hist_thresholds=False,
+        spoil_split_scores=False)
+    print(f"batch part {batch_part}, bootstrap {bootstrap}, seed "
+        f"{random_state}: MAE {score(model, x_test, y_test)}, fit {fit_time} s")
+    return model.predict(x_test)
+
+
+def main():
+    rng = np.random.default_rng(RAND_STATE)
+    x_all = rng.normal(size=(1000000, 5))
+    y_all = np.sin(x_all).sum(axis=1) + 0.1 * rng.normal(size=x_all.shape[0])
+    x_tr, x_test, y_tr, y_test = split(x_all, y_all)
+    preds_all_rows = None
+    for batch_part in [1.0, 0.1]:
+        for bootstrap in [False, True]:
+            preds = fit_and_predict(x_tr, y_tr, x_test, y_test,
+                batch_part, bootstrap)
+            # the batches depend only on the random state
+            preds_again = fit_and_predict(x_tr, y_tr, x_test, y_test,
+                batch_part, bootstrap)
+            check(np.array_equal(preds, preds_again),
+                "the same random state gives the same model")
+            preds_other = fit_and_predict(x_tr, y_tr, x_test, y_test,
+                batch_part, bootstrap, RAND_STATE + 1)
+            if batch_part == 1.0 and not bootstrap:
+                # all the rows in each batch
+                check(np.array_equal(preds, preds_other),
+                    "the batch of all rows doesn't depend on the random state")
+                preds_all_rows = preds
+                continue
+            check(not np.array_equal(preds, preds_other),
+                "other random state gives other batches")
+            # the bootstrap of all rows takes some rows several times
+            if batch_part == 1.0:
+                check(not np.array_equal(preds, preds_all_rows),
+                    "the bootstrap batches differ from all the rows")
+    print("Finish")
+
+
+if __name__ == "__main__":
+    main()
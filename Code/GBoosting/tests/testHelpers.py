@@ -0,0 +1,51 @@
+from sklearn.model_selection import train_test_split
+from sklearn.datasets import make_regression
+from sklearn.metrics import mean_absolute_error as mae_score
+import time
+import os, sys
+
+# as the module is created in the upper directory
+sys.path.append(os.path.abspath(os.path.join(os.path.dirname(__file__), '..')))
+import regbm
+
+
+RAND_STATE = 12
+THREAD_COUNT = 4
+
+
+def split(x_all, y_all):
+    return train_test_split(x_all, y_all, test_size=0.2,
+        random_state=RAND_STATE)
+
+
+def make_data(n_samples, n_features=20, n_informative=10):
+    # x_tr, x_test, y_tr, y_test
+    x_all, y_all = make_regression(n_samples=n_samples,
+        n_features=n_features, n_informative=n_informative, n_targets=1,
+        shuffle=True, random_state=RAND_STATE)
+    return split(x_all, y_all)
+
+
+def fit_model(x_tr, y_tr, x_test, y_test, model_args=None, **fit_args):
+    # the fitted model and the fit time (s);
+    # fit_args override the default fit parameters below
+    model = regbm.Boosting(no_early_stopping=True, thread_cnt=THREAD_COUNT,
+        **(model_args or {}))
+    params = dict(tree_count=100, tree_depth=6, feature_fold_size=1.0,
+        learning_rate=0.1, random_state=RAND_STATE)
+    params.update(fit_args)
+    start_time = time.time()
+    model.fit(x_train=x_tr, y_train=y_tr, x_valid=x_test, y_valid=y_test,
+        **params)
+    return model, time.time() - start_time
+
+
+def score(model, x_test, y_test):
+    return mae_score(y_test, model.predict(x_test))
+
+
+def check(passed, what):
+    # a failed check stops the test with the exit code 1
+    print(f"{what}: {'passed' if passed else 'FAILED'}")
+    if not passed:
+        sys.exit(1)